@@ -0,0 +1,95 @@
+/**
+ * @File queue_bench.c
+ *
+ * Push/pop throughput of a queue_t implementation.  Built once against
+ * queue.c (bench/queue_bench_sem) and once against queue_ring.c
+ * (bench/queue_bench_ring) so the two can be compared.
+ *
+ * Half of the threads push and the other half pop (a single thread
+ * alternates), for 1, 2, 4, ... up to the maximum thread count.
+ *
+ * Usage: ./bench/queue_bench_<impl> [max_threads] [ops_per_thread] [queue_size]
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../queue.h"
+
+typedef struct {
+    queue_t *q;
+    long ops;
+    int role; // 0 alternate, 1 push, 2 pop
+    // When this worker started and finished its loop
+    double start;
+    double end;
+} worker_args_t;
+
+static pthread_barrier_t start_barrier;
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *worker(void *arg) {
+    worker_args_t *w = (worker_args_t *) arg;
+    void *elem;
+    pthread_barrier_wait(&start_barrier);
+    w->start = now_s();
+    for (long i = 0; i < w->ops; i++) {
+        if (w->role != 2)
+            queue_push(w->q, (void *) (uintptr_t) (i + 1));
+        if (w->role != 1)
+            queue_pop(w->q, &elem);
+    }
+    w->end = now_s();
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    int max_threads = argc > 1 ? atoi(argv[1]) : 64;
+    long ops = argc > 2 ? atol(argv[2]) : 200000;
+    int size = argc > 3 ? atoi(argv[3]) : 1024;
+    if (max_threads <= 0 || ops <= 0 || size <= 0) {
+        fprintf(stderr, "usage: %s [max_threads] [ops_per_thread] [queue_size]\n", argv[0]);
+        return 1;
+    }
+
+    printf("%8s %16s %12s\n", "threads", "ops/s", "ns/op");
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        queue_t *q = queue_new(size);
+        pthread_t tids[threads];
+        worker_args_t args[threads];
+        pthread_barrier_init(&start_barrier, NULL, threads + 1);
+        for (int i = 0; i < threads; i++) {
+            args[i].q = q;
+            args[i].ops = ops;
+            args[i].role = threads == 1 ? 0 : (i % 2 == 0 ? 1 : 2);
+            pthread_create(&tids[i], NULL, worker, &args[i]);
+        }
+        pthread_barrier_wait(&start_barrier);
+        // The workers time themselves: main may not run again until they
+        // are done, so a clock read here could miss the whole run
+        for (int i = 0; i < threads; i++)
+            pthread_join(tids[i], NULL);
+        double start = args[0].start, end = args[0].end;
+        for (int i = 1; i < threads; i++) {
+            if (args[i].start < start)
+                start = args[i].start;
+            if (args[i].end > end)
+                end = args[i].end;
+        }
+        double elapsed = end - start;
+        pthread_barrier_destroy(&start_barrier);
+        queue_delete(&q);
+
+        // Every element is pushed once and popped once
+        double total = (threads == 1 ? 2.0 : 1.0) * ops * threads;
+        printf("%8d %16.0f %12.1f\n", threads, total / elapsed, elapsed * 1e9 / total);
+    }
+    return 0;
+}
@@ -0,0 +1,255 @@
+/**
+ * @File rwlock_bench.c
+ *
+ * Contention and fairness of an rwlock_t implementation under each
+ * priority.  Built once against rwlock.c (bench/rwlock_bench_cond) and
+ * once against rwlock_futex.c (bench/rwlock_bench_futex).
+ *
+ * Reader and writer threads loop: think, acquire, hold the lock for the
+ * critical section, release.  Both phases busy-wait for the given time.
+ * Every configuration (READERS, WRITERS, and N_WAY for each n) runs in a
+ * child process of its own, so a lock that deadlocks is reported as
+ * stalled instead of hanging the benchmark.
+ *
+ * Usage: ./bench/rwlock_bench_<impl> [-r readers] [-w writers]
+ *            [-R read_cs_ns] [-W write_cs_ns] [-T think_ns] [-d seconds]
+ *            [-n n1,n2,...]
+ *
+ * For each role it prints acquisitions/s, the p50/p99/p999 time spent
+ * waiting for the lock, and the longest single wait (the worst
+ * starvation) in microseconds.
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "../rwlock.h"
+
+// Wait times go into log-linear buckets: 8 sub-buckets per power of two
+#define SUB_BITS 3
+#define BUCKETS  (64 << SUB_BITS)
+
+static int readers = 4;
+static int writers = 1;
+static long read_cs_ns = 1000;
+static long write_cs_ns = 1000;
+static long think_ns = 1000;
+static int duration = 2;
+
+static _Atomic bool stop = false;
+static pthread_barrier_t start_barrier;
+
+typedef struct {
+    rwlock_t *rw;
+    bool writer;
+    uint64_t acquisitions;
+    uint64_t max_wait;
+    // When this worker started and left its loop
+    uint64_t start;
+    uint64_t end;
+    uint64_t histogram[BUCKETS];
+} worker_t;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void spin_for(long ns) {
+    if (ns <= 0)
+        return;
+    uint64_t until = now_ns() + ns;
+    while (now_ns() < until)
+        ;
+}
+
+static int bucket_of(uint64_t ns) {
+    if (ns < (1u << SUB_BITS))
+        return (int) ns;
+    int top = 63 - __builtin_clzll(ns);
+    int sub = (int) ((ns >> (top - SUB_BITS)) & ((1u << SUB_BITS) - 1));
+    return ((top - SUB_BITS + 1) << SUB_BITS) + sub;
+}
+
+static uint64_t bucket_floor(int bucket) {
+    if (bucket < (1 << SUB_BITS))
+        return bucket;
+    int top = (bucket >> SUB_BITS) + SUB_BITS - 1;
+    uint64_t sub = bucket & ((1 << SUB_BITS) - 1);
+    return (1ULL << top) | (sub << (top - SUB_BITS));
+}
+
+static void *worker(void *arg) {
+    worker_t *w = (worker_t *) arg;
+    pthread_barrier_wait(&start_barrier);
+    w->start = now_ns();
+    while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+        spin_for(think_ns);
+        uint64_t start = now_ns();
+        if (w->writer)
+            writer_lock(w->rw);
+        else
+            reader_lock(w->rw);
+        uint64_t wait = now_ns() - start;
+        spin_for(w->writer ? write_cs_ns : read_cs_ns);
+        if (w->writer)
+            writer_unlock(w->rw);
+        else
+            reader_unlock(w->rw);
+
+        w->acquisitions++;
+        w->histogram[bucket_of(wait)]++;
+        if (wait > w->max_wait)
+            w->max_wait = wait;
+    }
+    w->end = now_ns();
+    return NULL;
+}
+
+static double percentile(const uint64_t *histogram, uint64_t total, double p) {
+    uint64_t rank = (uint64_t) (total * p);
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        seen += histogram[i];
+        if (seen > rank)
+            return bucket_floor(i) / 1000.0;
+    }
+    return 0;
+}
+
+static void report_role(worker_t *workers, int count, bool writer, double seconds) {
+    uint64_t histogram[BUCKETS] = { 0 };
+    uint64_t total = 0, max_wait = 0;
+    for (int i = 0; i < count; i++) {
+        if (workers[i].writer != writer)
+            continue;
+        total += workers[i].acquisitions;
+        for (int b = 0; b < BUCKETS; b++)
+            histogram[b] += workers[i].histogram[b];
+        if (workers[i].max_wait > max_wait)
+            max_wait = workers[i].max_wait;
+    }
+    printf("  %-8s %10.0f wait_us p50 %8.1f p99 %8.1f p999 %9.1f worst %10.1f",
+        writer ? "writes/s" : "reads/s", total / seconds, percentile(histogram, total, 0.50),
+        percentile(histogram, total, 0.99), percentile(histogram, total, 0.999),
+        max_wait / 1000.0);
+}
+
+// Runs one configuration in the calling (child) process
+static void run(PRIORITY priority, uint32_t n) {
+    rwlock_t *rw = rwlock_new(priority, n);
+    int count = readers + writers;
+    worker_t *workers = (worker_t *) calloc(count, sizeof(worker_t));
+    pthread_t *threads = (pthread_t *) malloc(count * sizeof(pthread_t));
+    if (rw == NULL || workers == NULL || threads == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    pthread_barrier_init(&start_barrier, NULL, count + 1);
+    for (int i = 0; i < count; i++) {
+        workers[i].rw = rw;
+        workers[i].writer = i >= readers;
+        pthread_create(&threads[i], NULL, worker, &workers[i]);
+    }
+    pthread_barrier_wait(&start_barrier);
+    sleep(duration);
+    atomic_store(&stop, true);
+    for (int i = 0; i < count; i++)
+        pthread_join(threads[i], NULL);
+    // The workers time themselves, as they may start long before main
+    // runs again after the barrier
+    uint64_t start = workers[0].start, end = workers[0].end;
+    for (int i = 1; i < count; i++) {
+        if (workers[i].start < start)
+            start = workers[i].start;
+        if (workers[i].end > end)
+            end = workers[i].end;
+    }
+    double seconds = (end - start) / 1e9;
+
+    if (readers > 0)
+        report_role(workers, count, false, seconds);
+    if (writers > 0)
+        report_role(workers, count, true, seconds);
+    printf("\n");
+    rwlock_delete(&rw);
+    free(workers);
+    free(threads);
+}
+
+static void run_isolated(const char *name, PRIORITY priority, uint32_t n) {
+    printf("%-7s n=%-3u", name, n);
+    fflush(stdout);
+    pid_t child = fork();
+    if (child == 0) {
+        run(priority, n);
+        fflush(stdout);
+        _exit(0);
+    }
+    // Give the run a generous grace period to wind down before calling it stalled
+    uint64_t deadline = now_ns() + (duration + 5) * 1000000000ULL;
+    int status;
+    while (waitpid(child, &status, WNOHANG) == 0) {
+        if (now_ns() > deadline) {
+            kill(child, SIGKILL);
+            waitpid(child, &status, 0);
+            printf("  stalled (deadlock or starvation past the run)\n");
+            return;
+        }
+        usleep(10000);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    char *n_list = "1,4,16";
+    int option;
+    while ((option = getopt(argc, argv, "r:w:R:W:T:d:n:")) != -1) {
+        switch (option) {
+        case 'r':
+            readers = atoi(optarg);
+            break;
+        case 'w':
+            writers = atoi(optarg);
+            break;
+        case 'R':
+            read_cs_ns = atol(optarg);
+            break;
+        case 'W':
+            write_cs_ns = atol(optarg);
+            break;
+        case 'T':
+            think_ns = atol(optarg);
+            break;
+        case 'd':
+            duration = atoi(optarg);
+            break;
+        case 'n':
+            n_list = optarg;
+            break;
+        default:
+            return 1;
+        }
+    }
+    if (readers < 0 || writers < 0 || readers + writers == 0 || duration <= 0) {
+        fprintf(stderr, "invalid arguments\n");
+        return 1;
+    }
+
+    printf("%d readers (cs %ld ns), %d writers (cs %ld ns), think %ld ns, %d s per run\n",
+        readers, read_cs_ns, writers, write_cs_ns, think_ns, duration);
+    run_isolated("READERS", READERS, 1);
+    run_isolated("WRITERS", WRITERS, 1);
+    for (char *item = strtok(n_list, ","); item != NULL; item = strtok(NULL, ","))
+        run_isolated("N_WAY", N_WAY, (uint32_t) atoi(item));
+    return 0;
+}
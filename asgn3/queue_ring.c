@@ -0,0 +1,204 @@
+#include "queue.h"
+#include <linux/futex.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Lock-free alternative to queue.c: a bounded multi-producer,
+// multi-consumer ring with a sequence number per slot (Vyukov's MPMC
+// queue).  Threads spin briefly on a full or empty queue and then sleep
+// on a futex; the uncontended path is one CAS and no system calls.
+
+#define SPIN_LIMIT 128
+
+typedef struct slot {
+    _Atomic size_t seq;
+    void *data;
+} slot_t;
+
+typedef struct queue {
+    alignas(64) _Atomic size_t enqueue_pos;
+    alignas(64) _Atomic size_t dequeue_pos;
+    // Bumped whenever an element is pushed, while a popper may sleep
+    alignas(64) _Atomic uint32_t not_empty;
+    _Atomic uint32_t pop_waiters;
+    // Bumped whenever an element is popped, while a pusher may sleep
+    alignas(64) _Atomic uint32_t not_full;
+    _Atomic uint32_t push_waiters;
+    alignas(64) size_t mask;
+    // The ring is rounded up to a power of two, but holds at most size elements
+    size_t size;
+    slot_t *slots;
+} queue_t;
+
+static void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+static void futex_wait(_Atomic uint32_t *addr, uint32_t expected) {
+    syscall(SYS_futex, (uint32_t *) addr, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+static void futex_wake(_Atomic uint32_t *addr, int count) {
+    syscall(SYS_futex, (uint32_t *) addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+queue_t *queue_new(int size) {
+    if (size <= 0) {
+        return NULL;
+    }
+    // The ring needs a power of two so positions map to slots with a mask
+    size_t capacity = 1;
+    while (capacity < (size_t) size)
+        capacity <<= 1;
+
+    queue_t *q = (queue_t *) aligned_alloc(64, sizeof(queue_t));
+    if (q == NULL) {
+        return NULL;
+    }
+    q->slots = (slot_t *) malloc(capacity * sizeof(slot_t));
+    if (q->slots == NULL) {
+        free(q);
+        return NULL;
+    }
+    for (size_t i = 0; i < capacity; i++) {
+        atomic_init(&q->slots[i].seq, i);
+        q->slots[i].data = NULL;
+    }
+    q->mask = capacity - 1;
+    q->size = size;
+    atomic_init(&q->enqueue_pos, 0);
+    atomic_init(&q->dequeue_pos, 0);
+    atomic_init(&q->not_empty, 0);
+    atomic_init(&q->pop_waiters, 0);
+    atomic_init(&q->not_full, 0);
+    atomic_init(&q->push_waiters, 0);
+    return q;
+}
+
+void queue_delete(queue_t **q) {
+    if (q == NULL || *q == NULL) {
+        return;
+    }
+    free((*q)->slots);
+    free(*q);
+    *q = NULL;
+}
+
+static bool try_push(queue_t *q, void *elem) {
+    size_t pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+    slot_t *slot;
+    while (1) {
+        slot = &q->slots[pos & q->mask];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+        if (diff == 0) {
+            // A stale dequeue position only makes this stricter; a pusher
+            // turned away sleeps until the next pop signals not_full
+            size_t head = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+            if ((intptr_t) (pos - head) >= (intptr_t) q->size)
+                return false;
+            if (atomic_compare_exchange_weak_explicit(
+                    &q->enqueue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            // The slot still holds the element from one lap ago: full
+            return false;
+        } else {
+            pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+        }
+    }
+    slot->data = elem;
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+    return true;
+}
+
+static bool try_pop(queue_t *q, void **elem) {
+    size_t pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+    slot_t *slot;
+    while (1) {
+        slot = &q->slots[pos & q->mask];
+        size_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(
+                    &q->dequeue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            // Nothing has been pushed into this slot yet: empty
+            return false;
+        } else {
+            pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+        }
+    }
+    *elem = slot->data;
+    atomic_store_explicit(&slot->seq, pos + q->mask + 1, memory_order_release);
+    return true;
+}
+
+// Wakes one thread sleeping on event, if any.  The fence pairs with the one
+// on the sleeping side of queue_push/queue_pop: either the sleeper sees our
+// update to the ring, or we see it registered as a waiter.
+static void signal_event(_Atomic uint32_t *event, _Atomic uint32_t *waiters) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(waiters, memory_order_relaxed) != 0) {
+        atomic_fetch_add(event, 1);
+        futex_wake(event, 1);
+    }
+}
+
+bool queue_push(queue_t *q, void *elem) {
+    if (q == NULL) {
+        return false;
+    }
+    for (int spin = 0; spin < SPIN_LIMIT; spin++) {
+        if (try_push(q, elem)) {
+            signal_event(&q->not_empty, &q->pop_waiters);
+            return true;
+        }
+        cpu_relax();
+    }
+    while (1) {
+        uint32_t seen = atomic_load(&q->not_full);
+        atomic_fetch_add(&q->push_waiters, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        bool pushed = try_push(q, elem);
+        if (!pushed)
+            futex_wait(&q->not_full, seen);
+        atomic_fetch_sub(&q->push_waiters, 1);
+        if (pushed || try_push(q, elem)) {
+            signal_event(&q->not_empty, &q->pop_waiters);
+            return true;
+        }
+    }
+}
+
+bool queue_pop(queue_t *q, void **elem) {
+    if (q == NULL) {
+        return false;
+    }
+    for (int spin = 0; spin < SPIN_LIMIT; spin++) {
+        if (try_pop(q, elem)) {
+            signal_event(&q->not_full, &q->push_waiters);
+            return true;
+        }
+        cpu_relax();
+    }
+    while (1) {
+        uint32_t seen = atomic_load(&q->not_empty);
+        atomic_fetch_add(&q->pop_waiters, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        bool popped = try_pop(q, elem);
+        if (!popped)
+            futex_wait(&q->not_empty, seen);
+        atomic_fetch_sub(&q->pop_waiters, 1);
+        if (popped || try_pop(q, elem)) {
+            signal_event(&q->not_full, &q->push_waiters);
+            return true;
+        }
+    }
+}
@@ -0,0 +1,222 @@
+#include "rwlock.h"
+#include <limits.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Alternative to rwlock.c that keeps the whole lock state in one atomic
+// word.  While nobody is waiting, acquiring and releasing the lock is a
+// single CAS on that word.  As soon as a thread has to wait it sets the
+// WAITERS bit, which sends every later acquire and release through the
+// slow path: there, under the guard mutex, grant() hands the lock to
+// waiting threads according to the priority and wakes them with a futex.
+
+#define READER_MASK 0x3fffffffu
+#define WRITER      0x40000000u
+#define WAITERS     0x80000000u
+
+struct rwlock {
+    _Atomic uint32_t state;
+    PRIORITY priority;
+    uint32_t n;
+    // Everything below is protected by guard
+    pthread_mutex_t guard;
+    uint32_t waiting_readers;
+    uint32_t waiting_writers;
+    // Waiters that grant() has already let in but that have not woken up
+    uint32_t readers_granted;
+    uint32_t writers_granted;
+    // N_WAY: whether readers may still enter ahead of a waiting writer,
+    // and how many have done so since the last writer
+    bool readers_turn;
+    uint32_t turn_readers;
+    _Atomic uint32_t reader_seq;
+    _Atomic uint32_t writer_seq;
+};
+
+static void futex_wait(_Atomic uint32_t *addr, uint32_t expected) {
+    syscall(SYS_futex, (uint32_t *) addr, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+static void futex_wake(_Atomic uint32_t *addr, int count) {
+    syscall(SYS_futex, (uint32_t *) addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+rwlock_t *rwlock_new(PRIORITY p, uint32_t n) {
+    rwlock_t *rw = (rwlock_t *) malloc(sizeof(rwlock_t));
+    if (rw == NULL) {
+        return NULL;
+    }
+    atomic_init(&rw->state, 0);
+    rw->priority = p;
+    rw->n = n;
+    pthread_mutex_init(&rw->guard, NULL);
+    rw->waiting_readers = 0;
+    rw->waiting_writers = 0;
+    rw->readers_granted = 0;
+    rw->writers_granted = 0;
+    rw->readers_turn = true;
+    rw->turn_readers = 0;
+    atomic_init(&rw->reader_seq, 0);
+    atomic_init(&rw->writer_seq, 0);
+    return rw;
+}
+
+void rwlock_delete(rwlock_t **rw) {
+    if (rw == NULL || *rw == NULL) {
+        return;
+    }
+    pthread_mutex_destroy(&(*rw)->guard);
+    free(*rw);
+    *rw = NULL;
+}
+
+static void admit_readers(rwlock_t *rw, uint32_t count) {
+    if (count == 0)
+        return;
+    atomic_fetch_add(&rw->state, count);
+    rw->readers_granted += count;
+    atomic_fetch_add(&rw->reader_seq, 1);
+    futex_wake(&rw->reader_seq, INT_MAX);
+}
+
+static void admit_writer(rwlock_t *rw) {
+    atomic_fetch_or(&rw->state, WRITER);
+    // After a writer, readers get the next turn.  This is set here rather
+    // than on release, which may take the fast path once this writer has
+    // left the wait.
+    rw->readers_turn = true;
+    rw->turn_readers = 0;
+    rw->writers_granted++;
+    atomic_fetch_add(&rw->writer_seq, 1);
+    futex_wake(&rw->writer_seq, 1);
+}
+
+// Hands the lock to waiting threads as far as the priority allows.  Must
+// be called with guard held and WAITERS set, so that no other thread can
+// change state behind our back.
+static void grant(rwlock_t *rw) {
+    uint32_t state = atomic_load(&rw->state);
+    if (state & WRITER)
+        return;
+    uint32_t active_readers = state & READER_MASK;
+    uint32_t readers = rw->waiting_readers - rw->readers_granted;
+    uint32_t writers = rw->waiting_writers - rw->writers_granted;
+
+    switch (rw->priority) {
+    case READERS:
+        if (readers > 0)
+            admit_readers(rw, readers);
+        else if (writers > 0 && active_readers == 0)
+            admit_writer(rw);
+        break;
+    case WRITERS:
+        if (writers > 0) {
+            if (active_readers == 0)
+                admit_writer(rw);
+        } else {
+            admit_readers(rw, readers);
+        }
+        break;
+    case N_WAY:
+        if (writers == 0) {
+            admit_readers(rw, readers);
+            break;
+        }
+        if (rw->readers_turn && readers > 0) {
+            uint32_t room = rw->n > rw->turn_readers ? rw->n - rw->turn_readers : 0;
+            uint32_t count = readers < room ? readers : room;
+            admit_readers(rw, count);
+            rw->turn_readers += count;
+            active_readers += count;
+            readers -= count;
+        }
+        if (rw->turn_readers >= rw->n || readers == 0)
+            rw->readers_turn = false;
+        if (!rw->readers_turn && active_readers == 0)
+            admit_writer(rw);
+        break;
+    }
+}
+
+// Called with guard held by a waiter that has just taken its grant
+static void leave_wait(rwlock_t *rw) {
+    if (rw->waiting_readers == 0 && rw->waiting_writers == 0)
+        atomic_fetch_and(&rw->state, ~WAITERS);
+}
+
+void reader_lock(rwlock_t *rw) {
+    uint32_t state = atomic_load_explicit(&rw->state, memory_order_relaxed);
+    while (!(state & (WRITER | WAITERS))) {
+        if (atomic_compare_exchange_weak_explicit(
+                &rw->state, &state, state + 1, memory_order_acquire, memory_order_relaxed))
+            return;
+    }
+
+    pthread_mutex_lock(&rw->guard);
+    rw->waiting_readers++;
+    atomic_fetch_or(&rw->state, WAITERS);
+    grant(rw);
+    while (rw->readers_granted == 0) {
+        uint32_t seq = atomic_load(&rw->reader_seq);
+        pthread_mutex_unlock(&rw->guard);
+        futex_wait(&rw->reader_seq, seq);
+        pthread_mutex_lock(&rw->guard);
+    }
+    rw->readers_granted--;
+    rw->waiting_readers--;
+    leave_wait(rw);
+    pthread_mutex_unlock(&rw->guard);
+}
+
+void reader_unlock(rwlock_t *rw) {
+    uint32_t state = atomic_load_explicit(&rw->state, memory_order_relaxed);
+    while (!(state & WAITERS)) {
+        if (atomic_compare_exchange_weak_explicit(
+                &rw->state, &state, state - 1, memory_order_release, memory_order_relaxed))
+            return;
+    }
+
+    pthread_mutex_lock(&rw->guard);
+    atomic_fetch_sub(&rw->state, 1);
+    grant(rw);
+    pthread_mutex_unlock(&rw->guard);
+}
+
+void writer_lock(rwlock_t *rw) {
+    uint32_t expected = 0;
+    if (atomic_compare_exchange_strong_explicit(
+            &rw->state, &expected, WRITER, memory_order_acquire, memory_order_relaxed))
+        return;
+
+    pthread_mutex_lock(&rw->guard);
+    rw->waiting_writers++;
+    atomic_fetch_or(&rw->state, WAITERS);
+    grant(rw);
+    while (rw->writers_granted == 0) {
+        uint32_t seq = atomic_load(&rw->writer_seq);
+        pthread_mutex_unlock(&rw->guard);
+        futex_wait(&rw->writer_seq, seq);
+        pthread_mutex_lock(&rw->guard);
+    }
+    rw->writers_granted--;
+    rw->waiting_writers--;
+    leave_wait(rw);
+    pthread_mutex_unlock(&rw->guard);
+}
+
+void writer_unlock(rwlock_t *rw) {
+    uint32_t expected = WRITER;
+    if (atomic_compare_exchange_strong_explicit(
+            &rw->state, &expected, 0, memory_order_release, memory_order_relaxed))
+        return;
+
+    pthread_mutex_lock(&rw->guard);
+    atomic_fetch_and(&rw->state, ~WRITER);
+    grant(rw);
+    pthread_mutex_unlock(&rw->guard);
+}
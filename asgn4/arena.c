@@ -0,0 +1,133 @@
+#include "arena.h"
+#include <stdalign.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stats.h"
+
+#define ARENA_MIN_BLOCK (16 << 10)
+#define ALIGNMENT       alignof(max_align_t)
+
+static inline size_t round_up(size_t size) {
+    return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+}
+
+typedef struct block {
+    struct block *next;
+    size_t size;
+    size_t used;
+    alignas(max_align_t) char data[];
+} block_t;
+
+typedef struct arena {
+    block_t *blocks; // The block being carved up at the head
+    size_t allocated; // Bytes handed out since the last reset
+    size_t next_size; // Size of the block to start with after a reset
+} arena_t;
+
+static __thread arena_t arena = { NULL, 0, ARENA_MIN_BLOCK };
+
+// Wraps every heap allocation, counting it in the calling thread's stats
+static void *counted(void *p) {
+    if (p != NULL)
+        stats_heap_allocation();
+    return p;
+}
+
+void *arena_alloc(size_t size) {
+    size = round_up(size);
+    block_t *block = arena.blocks;
+    if (block == NULL || block->size - block->used < size) {
+        size_t block_size = arena.next_size > size ? arena.next_size : size;
+        block = (block_t *) counted(malloc(sizeof(block_t) + block_size));
+        if (block == NULL)
+            return NULL;
+        block->size = block_size;
+        block->used = 0;
+        block->next = arena.blocks;
+        arena.blocks = block;
+    }
+    void *p = block->data + block->used;
+    block->used += size;
+    arena.allocated += size;
+    return p;
+}
+
+static void free_blocks(void) {
+    while (arena.blocks != NULL) {
+        block_t *next = arena.blocks->next;
+        free(arena.blocks);
+        arena.blocks = next;
+    }
+}
+
+void arena_reset(void) {
+    if (arena.blocks != NULL && arena.blocks->next != NULL) {
+        // The request outgrew the block; start over with one that would
+        // have held all of it, so the same request fits without a malloc
+        free_blocks();
+        if (arena.allocated > arena.next_size)
+            arena.next_size
+                = arena.allocated < ARENA_RETAIN_MAX ? arena.allocated : ARENA_RETAIN_MAX;
+    } else if (arena.blocks != NULL && arena.blocks->size > ARENA_RETAIN_MAX) {
+        free_blocks();
+    } else if (arena.blocks != NULL) {
+        arena.blocks->used = 0;
+    }
+    arena.allocated = 0;
+}
+
+void arena_thread_exit(void) {
+    free_blocks();
+    arena.allocated = 0;
+    arena.next_size = ARENA_MIN_BLOCK;
+}
+
+void fixed_pool_init(fixed_pool_t *p, size_t object_size, size_t per_slab) {
+    // Free objects hold the free list link
+    p->object_size = round_up(object_size < sizeof(void *) ? sizeof(void *) : object_size);
+    p->per_slab = per_slab > 0 ? per_slab : 1;
+    p->free_list = NULL;
+    p->slabs = NULL;
+}
+
+void *fixed_pool_get(fixed_pool_t *p) {
+    if (p->free_list == NULL) {
+        // A slab starts with the link to the previous slab
+        char *slab = (char *) counted(calloc(1, ALIGNMENT + p->per_slab * p->object_size));
+        if (slab == NULL)
+            return NULL;
+        *(void **) slab = p->slabs;
+        p->slabs = slab;
+        for (size_t i = 0; i < p->per_slab; i++)
+            fixed_pool_put(p, slab + ALIGNMENT + i * p->object_size);
+    }
+    void *object = p->free_list;
+    p->free_list = *(void **) object;
+    return object;
+}
+
+void fixed_pool_put(fixed_pool_t *p, void *object) {
+    *(void **) object = p->free_list;
+    p->free_list = object;
+}
+
+void fixed_pool_destroy(fixed_pool_t *p) {
+    while (p->slabs != NULL) {
+        void *next = *(void **) p->slabs;
+        free(p->slabs);
+        p->slabs = next;
+    }
+    p->free_list = NULL;
+}
+
+void *arena_heap_alloc(size_t size) {
+    return counted(malloc(size));
+}
+
+void *arena_heap_calloc(size_t count, size_t size) {
+    return counted(calloc(count, size));
+}
+
+char *arena_heap_strdup(const char *s) {
+    return (char *) counted(strdup(s));
+}
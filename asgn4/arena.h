@@ -0,0 +1,83 @@
+/**
+ * @File arena.h
+ *
+ * Allocators that keep the request path off malloc.  Each thread has a
+ * bump arena for memory that only lives as long as one request; it is
+ * reset wholesale once the request has been answered.  Long-lived nodes
+ * of a single size (registry entries, connections) come from fixed-size
+ * pools that recycle freed nodes instead of handing them back to malloc.
+ *
+ * Both only fall back to the heap to grow.  They count every time they
+ * do in the calling thread's stats block (stats.h), as do the
+ * arena_heap_* wrappers, which every other allocation made while
+ * serving a request goes through (cached objects and their cache
+ * entries, map cache entries, long URIs in the registry and the audit
+ * log).  A climbing heap_allocations in GET /_stats is the sum of all
+ * of these.  The one allocation it misses is the rwlock a registry
+ * entry gets the first time it is used, which the rwlock library makes
+ * itself.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+// The most an idle arena holds on to between requests
+#define ARENA_RETAIN_MAX (1 << 20)
+
+/** @brief Allocates size bytes from the calling thread's arena, aligned
+ *         for any type.  The memory stays valid until the thread calls
+ *         arena_reset and must not be freed.
+ *
+ *  @return a pointer to the memory, or NULL if the heap is exhausted.
+ */
+void *arena_alloc(size_t size);
+
+/** @brief Releases everything the calling thread allocated from its
+ *         arena.  The arena keeps one block big enough for the largest
+ *         request seen so far, up to ARENA_RETAIN_MAX bytes.
+ */
+void arena_reset(void);
+
+/** @brief Frees the calling thread's arena.  Call before the thread exits.
+ */
+void arena_thread_exit(void);
+
+/** @struct fixed_pool_t
+ *  @brief Objects of one size, carved out of slabs and recycled through a
+ *         free list.  Not thread-safe: the owner serializes every call.
+ */
+typedef struct fixed_pool {
+    size_t object_size;
+    size_t per_slab;
+    void *free_list;
+    void *slabs;
+} fixed_pool_t;
+
+/** @brief Initializes an empty pool of object_size byte objects, which
+ *         grows per_slab objects at a time.
+ */
+void fixed_pool_init(fixed_pool_t *p, size_t object_size, size_t per_slab);
+
+/** @brief Takes an object from the pool, aligned for any type.  An
+ *         object new to the pool is zeroed; a recycled one keeps what it
+ *         held when it was put back, apart from its first pointer.
+ *
+ *  @return a pointer to the object, or NULL if the heap is exhausted.
+ */
+void *fixed_pool_get(fixed_pool_t *p);
+
+/** @brief Gives an object taken from p back to it.
+ */
+void fixed_pool_put(fixed_pool_t *p, void *object);
+
+/** @brief Frees every slab of the pool, including objects still in use.
+ */
+void fixed_pool_destroy(fixed_pool_t *p);
+
+/** @brief malloc, calloc and strdup, counted in heap_allocations.  Free
+ *         the result with free.
+ */
+void *arena_heap_alloc(size_t size);
+void *arena_heap_calloc(size_t count, size_t size);
+char *arena_heap_strdup(const char *s);
@@ -0,0 +1,197 @@
+#include "audit_log.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "arena.h"
+
+#define METHOD_FIELD  16
+#define URI_FIELD     72
+#define OUTPUT_SIZE   (64 << 10)
+
+typedef struct log_record {
+    uint64_t seq;
+    ssize_t request_id;
+    int status_code;
+    char method[METHOD_FIELD];
+    char uri[URI_FIELD];
+    // Only set for a URI too long for the uri field; freed by the flusher
+    char *long_uri;
+} log_record_t;
+
+// A single producer, single consumer ring owned by one thread at a time
+typedef struct log_ring {
+    alignas(64) _Atomic size_t head;
+    alignas(64) _Atomic size_t tail;
+    alignas(64) _Atomic int in_use;
+    struct log_ring *next;
+    log_record_t records[];
+} log_ring_t;
+
+static _Atomic(log_ring_t *) rings = NULL;
+static _Atomic uint64_t next_seq = 0;
+static size_t ring_mask;
+static int interval_ms;
+static sigset_t stop_signals;
+static __thread log_ring_t *my_ring = NULL;
+
+static log_ring_t *claim_ring(void) {
+    for (log_ring_t *ring = atomic_load(&rings); ring != NULL; ring = ring->next) {
+        int expected = 0;
+        if (atomic_compare_exchange_strong(&ring->in_use, &expected, 1))
+            return ring;
+    }
+    log_ring_t *ring = (log_ring_t *) aligned_alloc(
+        64, (sizeof(log_ring_t) + (ring_mask + 1) * sizeof(log_record_t) + 63) & ~(size_t) 63);
+    if (ring == NULL)
+        return NULL;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->in_use, 1);
+    ring->next = atomic_load(&rings);
+    while (!atomic_compare_exchange_weak(&rings, &ring->next, ring))
+        ;
+    return ring;
+}
+
+void audit_log_thread_exit(void) {
+    if (my_ring != NULL) {
+        atomic_store(&my_ring->in_use, 0);
+        my_ring = NULL;
+    }
+}
+
+void audit_log(const char *method, const char *uri, int status_code, ssize_t request_id) {
+    if (interval_ms == 0) {
+        fprintf(stderr, "%s,%s,%d,%zd\n", method, uri, status_code, request_id);
+        fflush(stderr);
+        return;
+    }
+    if (my_ring == NULL && (my_ring = claim_ring()) == NULL) {
+        return;
+    }
+    log_ring_t *ring = my_ring;
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    // Wait for room before taking a sequence number, so the flusher never
+    // waits on an entry that is stuck behind a full buffer
+    while (tail - atomic_load_explicit(&ring->head, memory_order_acquire) > ring_mask)
+        sched_yield();
+
+    log_record_t *record = &ring->records[tail & ring_mask];
+    record->request_id = request_id;
+    record->status_code = status_code;
+    snprintf(record->method, METHOD_FIELD, "%s", method);
+    size_t uri_length = strlen(uri);
+    if (uri_length < URI_FIELD) {
+        memcpy(record->uri, uri, uri_length + 1);
+        record->long_uri = NULL;
+    } else {
+        record->uri[0] = '\0';
+        record->long_uri = arena_heap_strdup(uri);
+    }
+    record->seq = atomic_fetch_add(&next_seq, 1);
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+static void write_all(const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(STDERR_FILENO, buf, len);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        buf += written;
+        len -= written;
+    }
+}
+
+// Writes out every entry that can be written in order: it stops at the
+// first sequence number that a producer has taken but not yet published.
+static void drain(uint64_t *expected) {
+    static char output[OUTPUT_SIZE];
+    size_t used = 0;
+    while (1) {
+        log_ring_t *best = NULL;
+        log_record_t *record = NULL;
+        for (log_ring_t *ring = atomic_load(&rings); ring != NULL; ring = ring->next) {
+            size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+            if (head == atomic_load_explicit(&ring->tail, memory_order_acquire))
+                continue;
+            log_record_t *candidate = &ring->records[head & ring_mask];
+            if (record == NULL || candidate->seq < record->seq) {
+                best = ring;
+                record = candidate;
+            }
+        }
+        if (record == NULL || record->seq != *expected)
+            break;
+
+        const char *uri = record->long_uri != NULL ? record->long_uri : record->uri;
+        if (OUTPUT_SIZE - used < strlen(uri) + 64) {
+            write_all(output, used);
+            used = 0;
+        }
+        // The check above leaves room for the whole line
+        used += snprintf(output + used, OUTPUT_SIZE - used, "%s,%s,%d,%zd\n", record->method,
+            uri, record->status_code, record->request_id);
+        free(record->long_uri);
+        atomic_store_explicit(&best->head, atomic_load(&best->head) + 1, memory_order_release);
+        (*expected)++;
+    }
+    write_all(output, used);
+}
+
+static void *flusher(void *arg) {
+    (void) arg;
+    uint64_t expected = 0;
+    struct timespec interval = { interval_ms / 1000, (interval_ms % 1000) * 1000000L };
+    while (1) {
+        int sig = sigtimedwait(&stop_signals, NULL, &interval);
+        drain(&expected);
+        if (sig > 0) {
+            // Give producers that already hold a sequence number a moment
+            // to publish it, then go down the way the signal asked
+            struct timespec grace = { 0, 10000000L };
+            nanosleep(&grace, NULL);
+            drain(&expected);
+            signal(sig, SIG_DFL);
+            pthread_sigmask(SIG_UNBLOCK, &stop_signals, NULL);
+            raise(sig);
+        }
+    }
+    return NULL;
+}
+
+int audit_log_init(size_t buffer_records, int flush_interval_ms) {
+    interval_ms = flush_interval_ms;
+    if (interval_ms == 0) {
+        return 0;
+    }
+    size_t capacity = 1;
+    while (capacity < buffer_records)
+        capacity <<= 1;
+    ring_mask = capacity - 1;
+
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, NULL);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, flusher, NULL) != 0) {
+        pthread_sigmask(SIG_UNBLOCK, &stop_signals, NULL);
+        interval_ms = 0;
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
@@ -0,0 +1,40 @@
+/**
+ * @File audit_log.h
+ *
+ * Asynchronous writer for the "method,uri,status,request_id" audit log
+ * on stderr.  Worker threads append fixed-size records to a buffer of
+ * their own without taking any lock; a flusher thread merges the buffers
+ * back into the order the entries were made and writes them out in
+ * large batches.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+/** @brief Starts the flusher thread.  Must be called before any other
+ *         thread is created: it blocks SIGINT and SIGTERM in the calling
+ *         thread (and so in every thread created afterwards) and lets the
+ *         flusher catch them, write out everything logged so far, and
+ *         then terminate the process with the same signal.
+ *
+ *  @param buffer_records The capacity of each thread's buffer, rounded
+ *         up to a power of two.
+ *
+ *  @param flush_interval_ms How often the flusher writes out new
+ *         entries.  0 makes audit_log write each entry synchronously.
+ *
+ *  @return 0, or -1 if the flusher could not be started.
+ */
+int audit_log_init(size_t buffer_records, int flush_interval_ms);
+
+/** @brief Appends an entry.  Entries appear in the log in the order of
+ *         their audit_log calls, so calling it while holding the URI's
+ *         lock orders entries the same way as the lock acquisitions.
+ */
+void audit_log(const char *method, const char *uri, int status_code, ssize_t request_id);
+
+/** @brief Gives the calling thread's buffer back for reuse by a later
+ *         thread.  Entries already in it are still written out.
+ */
+void audit_log_thread_exit(void);
@@ -0,0 +1,372 @@
+/**
+ * @File loadgen.c
+ *
+ * Closed-loop load generator for httpserver.  Every connection runs on
+ * its own thread and sends its next request as soon as the previous
+ * response has been read.  Before the run each URI is PUT once, so GETs
+ * find their object; the sizes come from the -s distribution and URIs
+ * are picked uniformly or by a Zipf distribution.
+ *
+ * Usage: ./bench/loadgen [-H host] [-p port] [-c connections]
+ *            [-d seconds] [-w put_percent] [-s size] [-u uris]
+ *            [-z zipf_exponent] [-x]
+ *
+ *   -s fixed:N or uniform:MIN:MAX object sizes in bytes (fixed:4096)
+ *   -x opens a new connection for every request (no keep-alive)
+ *
+ * Prints one line: requests, errors, req/s, MB/s (bodies in both
+ * directions) and the p50/p99/p999 latency in microseconds.
+ */
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <err.h>
+#include <errno.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define HEADER_SIZE 2048
+#define IO_SIZE     (64 << 10)
+
+static const char *host = "127.0.0.1";
+static int port = 8080;
+static int connections = 16;
+static int duration = 10;
+static int put_percent = 0;
+static size_t size_min = 4096;
+static size_t size_max = 4096;
+static int uri_count = 100;
+static double zipf_exponent = 0;
+static bool keep_alive = true;
+
+static size_t *uri_sizes;
+// Cumulative probability of picking each URI
+static double *uri_cdf;
+static _Atomic bool stop = false;
+
+typedef struct worker {
+    pthread_t thread;
+    uint64_t seed;
+    uint64_t requests;
+    uint64_t errors;
+    uint64_t bytes;
+    uint64_t *latencies;
+    size_t latency_count;
+    size_t latency_capacity;
+} worker_t;
+
+static uint64_t next_random(uint64_t *state) {
+    // xorshift64*
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static double next_unit(uint64_t *state) {
+    return (next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int pick_uri(uint64_t *state) {
+    double u = next_unit(state);
+    int low = 0, high = uri_count - 1;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (uri_cdf[mid] < u)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+static int connect_server(void) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1)
+        return -1;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, host, &addr.sin_addr);
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool send_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR)
+                continue;
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+// Reads one response and discards its body.  Returns the status code, or
+// -1 if the connection failed; *closing is set if the server said it will
+// close the connection.
+static int read_response(int fd, char *buf, uint64_t *body_bytes, bool *closing) {
+    size_t len = 0;
+    char *end = NULL;
+    while (end == NULL) {
+        if (len == HEADER_SIZE)
+            return -1;
+        ssize_t n = recv(fd, buf + len, HEADER_SIZE - len, 0);
+        if (n <= 0)
+            return -1;
+        len += n;
+        buf[len] = '\0';
+        end = strstr(buf, "\r\n\r\n");
+    }
+    int status = 0;
+    if (sscanf(buf, "HTTP/1.1 %d", &status) != 1)
+        return -1;
+    char *field = strcasestr(buf, "Content-Length: ");
+    size_t content_length = field != NULL ? strtoull(field + 16, NULL, 10) : 0;
+    *closing = strcasestr(buf, "Connection: close") != NULL;
+
+    size_t have = len - (end + 4 - buf);
+    size_t remaining = content_length > have ? content_length - have : 0;
+    char sink[IO_SIZE];
+    while (remaining > 0) {
+        ssize_t n = recv(fd, sink, remaining < IO_SIZE ? remaining : IO_SIZE, 0);
+        if (n <= 0)
+            return -1;
+        remaining -= n;
+    }
+    *body_bytes += content_length;
+    return status;
+}
+
+static void record_latency(worker_t *w, uint64_t ns) {
+    if (w->latency_count == w->latency_capacity) {
+        w->latency_capacity = w->latency_capacity ? 2 * w->latency_capacity : 4096;
+        w->latencies
+            = (uint64_t *) realloc(w->latencies, w->latency_capacity * sizeof(uint64_t));
+        if (w->latencies == NULL)
+            err(EXIT_FAILURE, "realloc");
+    }
+    w->latencies[w->latency_count++] = ns;
+}
+
+// Sends one request on *fd, connecting first if needed
+static bool do_request(worker_t *w, int *fd, bool put, int uri, const char *payload) {
+    char buf[HEADER_SIZE + 1];
+    size_t size = uri_sizes[uri];
+    int header_length;
+    if (put)
+        header_length = snprintf(buf, sizeof(buf),
+            "PUT /obj%d HTTP/1.1\r\nContent-Length: %zu\r\n%s\r\n", uri, size,
+            keep_alive ? "" : "Connection: close\r\n");
+    else
+        header_length = snprintf(buf, sizeof(buf), "GET /obj%d HTTP/1.1\r\n%s\r\n", uri,
+            keep_alive ? "" : "Connection: close\r\n");
+
+    if (*fd == -1 && (*fd = connect_server()) == -1)
+        return false;
+    if (!send_all(*fd, buf, header_length) || (put && !send_all(*fd, payload, size)))
+        return false;
+    bool closing = false;
+    uint64_t body_bytes = 0;
+    int status = read_response(*fd, buf, &body_bytes, &closing);
+    if (closing || status < 0) {
+        close(*fd);
+        *fd = -1;
+    }
+    if (status != 200 && status != 201)
+        return false;
+    w->bytes += put ? size : body_bytes;
+    return true;
+}
+
+static void *run_worker(void *arg) {
+    worker_t *w = (worker_t *) arg;
+    char *payload = (char *) malloc(size_max > 0 ? size_max : 1);
+    if (payload == NULL)
+        err(EXIT_FAILURE, "malloc");
+    memset(payload, 'x', size_max);
+    int fd = -1;
+    while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+        bool put = (int) (next_random(&w->seed) % 100) < put_percent;
+        int uri = pick_uri(&w->seed);
+        uint64_t start = now_ns();
+        bool ok = do_request(w, &fd, put, uri, payload);
+        record_latency(w, now_ns() - start);
+        w->requests++;
+        if (!ok) {
+            w->errors++;
+            if (fd != -1) {
+                close(fd);
+                fd = -1;
+            }
+        }
+    }
+    if (fd != -1)
+        close(fd);
+    free(payload);
+    return NULL;
+}
+
+// PUTs every URI once so the run finds all objects present
+static void populate(void) {
+    worker_t w;
+    memset(&w, 0, sizeof(w));
+    char *payload = (char *) malloc(size_max > 0 ? size_max : 1);
+    if (payload == NULL)
+        err(EXIT_FAILURE, "malloc");
+    memset(payload, 'x', size_max);
+    int fd = -1;
+    for (int uri = 0; uri < uri_count; uri++)
+        if (!do_request(&w, &fd, true, uri, payload))
+            errx(EXIT_FAILURE, "could not PUT /obj%d to %s:%d", uri, host, port);
+    if (fd != -1)
+        close(fd);
+    free(payload);
+    free(w.latencies);
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+static bool parse_sizes(const char *spec) {
+    char *end;
+    if (strncmp(spec, "fixed:", 6) == 0) {
+        size_min = size_max = strtoull(spec + 6, &end, 10);
+        return *end == '\0';
+    }
+    if (strncmp(spec, "uniform:", 8) == 0) {
+        size_min = strtoull(spec + 8, &end, 10);
+        if (*end != ':')
+            return false;
+        size_max = strtoull(end + 1, &end, 10);
+        return *end == '\0' && size_min <= size_max;
+    }
+    return false;
+}
+
+int main(int argc, char *argv[]) {
+    int option;
+    while ((option = getopt(argc, argv, "H:p:c:d:w:s:u:z:x")) != -1) {
+        switch (option) {
+        case 'H':
+            host = optarg;
+            break;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'c':
+            connections = atoi(optarg);
+            break;
+        case 'd':
+            duration = atoi(optarg);
+            break;
+        case 'w':
+            put_percent = atoi(optarg);
+            break;
+        case 's':
+            if (!parse_sizes(optarg))
+                errx(EXIT_FAILURE, "invalid size distribution: %s", optarg);
+            break;
+        case 'u':
+            uri_count = atoi(optarg);
+            break;
+        case 'z':
+            zipf_exponent = atof(optarg);
+            break;
+        case 'x':
+            keep_alive = false;
+            break;
+        default:
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (connections <= 0 || duration <= 0 || uri_count <= 0 || put_percent < 0
+        || put_percent > 100 || zipf_exponent < 0)
+        errx(EXIT_FAILURE, "invalid arguments");
+
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+    uri_sizes = (size_t *) malloc(uri_count * sizeof(size_t));
+    uri_cdf = (double *) malloc(uri_count * sizeof(double));
+    if (uri_sizes == NULL || uri_cdf == NULL)
+        err(EXIT_FAILURE, "malloc");
+    double total = 0;
+    for (int i = 0; i < uri_count; i++) {
+        uri_sizes[i] = size_min + next_random(&seed) % (size_max - size_min + 1);
+        total += zipf_exponent > 0 ? 1.0 / pow(i + 1, zipf_exponent) : 1.0;
+        uri_cdf[i] = total;
+    }
+    for (int i = 0; i < uri_count; i++)
+        uri_cdf[i] /= total;
+
+    populate();
+
+    worker_t *workers = (worker_t *) calloc(connections, sizeof(worker_t));
+    if (workers == NULL)
+        err(EXIT_FAILURE, "calloc");
+    uint64_t start = now_ns();
+    for (int i = 0; i < connections; i++) {
+        workers[i].seed = seed + 0x100000001B3ULL * (i + 1);
+        if (pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]) != 0)
+            err(EXIT_FAILURE, "pthread_create");
+    }
+    sleep(duration);
+    atomic_store(&stop, true);
+
+    uint64_t requests = 0, errors = 0, bytes = 0;
+    size_t samples = 0;
+    for (int i = 0; i < connections; i++) {
+        pthread_join(workers[i].thread, NULL);
+        requests += workers[i].requests;
+        errors += workers[i].errors;
+        bytes += workers[i].bytes;
+        samples += workers[i].latency_count;
+    }
+    double seconds = (now_ns() - start) / 1e9;
+
+    uint64_t *latencies = (uint64_t *) malloc((samples > 0 ? samples : 1) * sizeof(uint64_t));
+    if (latencies == NULL)
+        err(EXIT_FAILURE, "malloc");
+    size_t at = 0;
+    for (int i = 0; i < connections; i++) {
+        memcpy(latencies + at, workers[i].latencies, workers[i].latency_count * sizeof(uint64_t));
+        at += workers[i].latency_count;
+        free(workers[i].latencies);
+    }
+    qsort(latencies, samples, sizeof(uint64_t), compare_u64);
+#define PERCENTILE(p) (samples > 0 ? latencies[(size_t) ((samples - 1) * (p))] / 1000.0 : 0.0)
+    printf("requests %lu errors %lu req/s %.1f MB/s %.2f p50_us %.1f p99_us %.1f p999_us %.1f\n",
+        (unsigned long) requests, (unsigned long) errors, requests / seconds,
+        bytes / seconds / 1e6, PERCENTILE(0.50), PERCENTILE(0.99), PERCENTILE(0.999));
+    free(latencies);
+    free(workers);
+    return 0;
+}
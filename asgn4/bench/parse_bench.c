@@ -0,0 +1,140 @@
+/**
+ * @File parse_bench.c
+ *
+ * Measures the cost of parsing a request header: the original
+ * sscanf/strstr/malloc based code that process_request used to run
+ * against the single pass http_parse_request.
+ *
+ * Usage: ./bench/parse_bench [iterations]
+ */
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../http_parse.h"
+
+#define BUFFER_SIZE 2048
+
+static const char *requests[] = {
+    "GET /index.html HTTP/1.1\r\nHost: localhost:8080\r\nUser-Agent: curl/7.88.1\r\n"
+    "Accept: */*\r\nRequest-Id: 17\r\n\r\n",
+    "PUT /upload.bin HTTP/1.1\r\nHost: localhost:8080\r\nUser-Agent: curl/7.88.1\r\n"
+    "Accept: */*\r\nContent-Length: 1048576\r\nRequest-Id: 18\r\n"
+    "Content-Type: application/octet-stream\r\n\r\n",
+};
+#define REQUEST_COUNT (sizeof(requests) / sizeof(requests[0]))
+
+// The parsing steps of process_request before the single pass parser
+static void extract_request_info(const char *buffer, char **method, char **uri, char **version) {
+    *method = (char *) malloc(strlen(buffer) + 1);
+    *uri = (char *) malloc(strlen(buffer) + 1);
+    *version = (char *) malloc(strlen(buffer) + 1);
+    sscanf(buffer, "%s %s %s", *method, *uri, *version);
+}
+
+static ssize_t find_number(const char *request, const char *header) {
+    const char *start = strstr(request, header);
+    if (start == NULL)
+        return -1;
+    ssize_t value;
+    sscanf(start + strlen(header), "%zd", &value);
+    return value;
+}
+
+static bool is_valid_header_field(const char *header_field) {
+    char key[129];
+    char value[129];
+    if (sscanf(header_field, "%128[^:]: %128[^\r\n]", key, value) != 2)
+        return false;
+    int value_start_index = strlen(key) + 2;
+    if (!(header_field[value_start_index - 1] == ' ' && header_field[value_start_index] != ' '))
+        return false;
+    for (int i = 0; key[i] != '\0'; ++i)
+        if (!(isalnum(key[i]) || key[i] == '.' || key[i] == '-'))
+            return false;
+    for (int i = 0; value[i] != '\0'; ++i)
+        if (!isprint(value[i]))
+            return false;
+    return true;
+}
+
+static bool legacy_parse(const char *buffer, ssize_t *content_length, ssize_t *request_id) {
+    char *method, *uri, *version;
+    extract_request_info(buffer, &method, &uri, &version);
+    bool ok = strlen(version) == 8 && strlen(uri) <= 64 && strlen(uri) >= 2
+              && strlen(method) <= 8 && uri[0] == '/' && strcmp(version, "HTTP/1.1") == 0;
+    for (size_t i = 1; ok && i < strlen(uri); ++i)
+        if (!(isalnum(uri[i]) || uri[i] == '.' || uri[i] == '-'))
+            ok = false;
+    *content_length = find_number(buffer, "Content-Length: ");
+    *request_id = find_number(buffer, "Request-Id: ");
+    const char *header_start = strstr(buffer, "\r\n") + 2;
+    const char *header_end = strstr(buffer, "\r\n\r\n") + 1;
+    const char *header_field = strstr(header_start, "\r\n");
+    while (ok && header_field != NULL && header_field < header_end) {
+        char *temp = (char *) malloc(header_field - header_start + 1);
+        memset(temp, '\0', header_field - header_start + 1);
+        memcpy(temp, header_start, header_field - header_start);
+        ok = is_valid_header_field(temp);
+        free(temp);
+        header_start = header_field + 2;
+        header_field = strstr(header_start, "\r\n");
+    }
+    free(method);
+    free(uri);
+    free(version);
+    return ok;
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(int argc, char *argv[]) {
+    long iterations = argc > 1 ? atol(argv[1]) : 1000000;
+    if (iterations <= 0) {
+        fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+    size_t lengths[REQUEST_COUNT];
+    for (size_t r = 0; r < REQUEST_COUNT; r++)
+        lengths[r] = strlen(requests[r]);
+
+    // Both loops copy the request into a fresh buffer first, as the server
+    // parses straight out of its receive buffer
+    char buffer[BUFFER_SIZE + 1];
+    ssize_t checksum = 0;
+
+    double start = now_ns();
+    for (long i = 0; i < iterations; i++) {
+        size_t r = i % REQUEST_COUNT;
+        memcpy(buffer, requests[r], lengths[r] + 1);
+        ssize_t content_length, request_id;
+        if (!legacy_parse(buffer, &content_length, &request_id))
+            return 1;
+        checksum += content_length + request_id;
+    }
+    double legacy = (now_ns() - start) / iterations;
+
+    start = now_ns();
+    for (long i = 0; i < iterations; i++) {
+        size_t r = i % REQUEST_COUNT;
+        memcpy(buffer, requests[r], lengths[r] + 1);
+        http_request_t req;
+        if (http_parse_request(buffer, lengths[r], &req) != PARSE_OK)
+            return 1;
+        checksum -= req.content_length + req.request_id;
+    }
+    double single_pass = (now_ns() - start) / iterations;
+
+    printf("iterations:          %ld\n", iterations);
+    printf("legacy parser:       %8.1f ns/request\n", legacy);
+    printf("http_parse_request:  %8.1f ns/request\n", single_pass);
+    printf("speedup:             %8.2fx\n", legacy / single_pass);
+    return checksum != 0;
+}
@@ -0,0 +1,34 @@
+#!/bin/bash
+# Runs bench/loadgen against httpserver once for every thread count and
+# prints one result line per run, so runs before and after a change can
+# be compared side by side.
+#
+# Usage: bench/sweep.sh [loadgen options...]
+#
+#   THREADS     thread counts to sweep (default "1 2 4 8 16")
+#   SERVER_ARGS extra httpserver options, e.g. "-s" or "-r -u"
+#   PORT        port to use (default: random)
+
+set -e
+cd "$(dirname "$0")/.."
+SERVER=$PWD/httpserver
+LOADGEN=$PWD/bench/loadgen
+THREADS=${THREADS:-"1 2 4 8 16"}
+[ -x "$SERVER" ] && [ -x "$LOADGEN" ] || { echo "run make and make bench first" >&2; exit 1; }
+
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+for t in $THREADS; do
+    port=${PORT:-$((20000 + RANDOM % 20000))}
+    (cd "$DIR" && exec "$SERVER" -t "$t" $SERVER_ARGS "$port" 2>/dev/null) &
+    server=$!
+    # Wait until the server accepts connections
+    for _ in $(seq 50); do
+        (exec 3<>/dev/tcp/127.0.0.1/"$port") 2>/dev/null && break
+        sleep 0.1
+    done
+    echo "threads $t $("$LOADGEN" -p "$port" "$@")"
+    kill "$server"
+    wait "$server" 2>/dev/null || true
+done
@@ -0,0 +1,150 @@
+#include "gzip.h"
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <zlib.h>
+#include "arena.h"
+
+#define STREAM_CHUNK  (64 << 10)
+// windowBits of 15 plus 16 asks zlib for a gzip wrapper instead of zlib's own
+#define GZIP_WINDOW   (15 + 16)
+
+// zlib's state lives in the request arena and goes away with the request
+static voidpf arena_zalloc(voidpf opaque, uInt items, uInt size) {
+    (void) opaque;
+    return arena_alloc((size_t) items * size);
+}
+
+static void arena_zfree(voidpf opaque, voidpf address) {
+    (void) opaque;
+    (void) address;
+}
+
+static bool deflate_start(z_stream *z) {
+    memset(z, 0, sizeof(*z));
+    z->zalloc = arena_zalloc;
+    z->zfree = arena_zfree;
+    return deflateInit2(z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, GZIP_WINDOW, 8, Z_DEFAULT_STRATEGY)
+           == Z_OK;
+}
+
+cached_object_t *gzip_object_new(const char *body, size_t length, const char *fields) {
+    z_stream z;
+    if (length > UINT_MAX || !deflate_start(&z))
+        return NULL;
+    size_t bound = deflateBound(&z, length);
+    char *out = (char *) arena_alloc(bound);
+    if (out == NULL) {
+        deflateEnd(&z);
+        return NULL;
+    }
+    z.next_in = (Bytef *) body;
+    z.avail_in = (uInt) length;
+    z.next_out = (Bytef *) out;
+    z.avail_out = (uInt) bound;
+    int result = deflate(&z, Z_FINISH);
+    size_t compressed = z.total_out;
+    deflateEnd(&z);
+
+    cached_object_t *obj;
+    if (result != Z_STREAM_END || compressed >= length) {
+        obj = cached_object_new("", 0, 0);
+    } else {
+        char header[384];
+        int header_length = snprintf(header, sizeof(header),
+            "HTTP/1.1 200 OK\r\nContent-Length: %zu\r\nContent-Encoding: gzip\r\n"
+            "Vary: Accept-Encoding\r\n%s",
+            compressed, fields);
+        obj = cached_object_new(header, header_length, compressed);
+        if (obj != NULL)
+            memcpy(obj->data + header_length, out, compressed);
+    }
+    return obj;
+}
+
+bool gzip_object_is_marker(const cached_object_t *obj) {
+    return obj->header_length == 0;
+}
+
+static ssize_t send_iov(int fd, struct iovec *iov, int count) {
+    ssize_t total = 0;
+    while (count > 0) {
+        ssize_t written = writev(fd, iov, count);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        total += written;
+        while (count > 0 && (size_t) written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *) iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return total;
+}
+
+// Sends the compressed bytes in out as one chunk, or the last chunk if
+// there are none
+static ssize_t send_chunk(int fd, const char *out, size_t length) {
+    char size_line[24];
+    int size_length = snprintf(size_line, sizeof(size_line), "%zx\r\n", length);
+    struct iovec iov[3] = {
+        { size_line, size_length },
+        { (char *) out, length },
+        { "\r\n", 2 },
+    };
+    return send_iov(fd, iov, 3);
+}
+
+ssize_t gzip_send_file(
+    int client_fd, const char *header, size_t header_length, int file_fd, size_t size) {
+    z_stream z;
+    char *in = (char *) arena_alloc(2 * STREAM_CHUNK);
+    if (in == NULL || !deflate_start(&z))
+        return -1;
+    char *out = in + STREAM_CHUNK;
+    struct iovec iov = { (char *) header, header_length };
+    ssize_t total = send_iov(client_fd, &iov, 1);
+    off_t offset = 0;
+    int result = Z_OK;
+    while (total >= 0 && result != Z_STREAM_END) {
+        if (z.avail_in == 0 && (size_t) offset < size) {
+            size_t chunk = size - offset < STREAM_CHUNK ? size - offset : STREAM_CHUNK;
+            ssize_t bytes_read = pread(file_fd, in, chunk, offset);
+            if (bytes_read <= 0) {
+                total = -1;
+                break;
+            }
+            offset += bytes_read;
+            z.next_in = (Bytef *) in;
+            z.avail_in = (uInt) bytes_read;
+        }
+        z.next_out = (Bytef *) out;
+        z.avail_out = STREAM_CHUNK;
+        result = deflate(&z, (size_t) offset == size ? Z_FINISH : Z_NO_FLUSH);
+        if (result == Z_STREAM_ERROR) {
+            total = -1;
+            break;
+        }
+        size_t produced = STREAM_CHUNK - z.avail_out;
+        if (produced > 0) {
+            ssize_t sent = send_chunk(client_fd, out, produced);
+            total = sent < 0 ? -1 : total + sent;
+        }
+    }
+    if (total >= 0) {
+        ssize_t sent = send_chunk(client_fd, NULL, 0);
+        total = sent < 0 ? -1 : total + sent;
+    }
+    deflateEnd(&z);
+    return total;
+}
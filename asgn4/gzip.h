@@ -0,0 +1,41 @@
+/**
+ * @File gzip.h
+ *
+ * gzip content coding for GET responses.  Small files get a compressed
+ * cache object that is built once and served like any other cached
+ * response; larger files are compressed while they are sent.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include "object_cache.h"
+
+// Files smaller than this are always sent as they are
+#define GZIP_MIN_SIZE 256
+
+/** @brief Compresses body into a new cache object whose header announces
+ *         Content-Encoding: gzip, followed by the header lines in fields.
+ *         If compression does not make the body smaller, the object has
+ *         no header and no body, which marks the file as not worth
+ *         compressing.
+ *
+ *  @return The object with a reference count of 1, or NULL on failure.
+ */
+cached_object_t *gzip_object_new(const char *body, size_t length, const char *fields);
+
+/** @brief Whether obj is the marker of a file not worth compressing.
+ */
+bool gzip_object_is_marker(const cached_object_t *obj);
+
+/** @brief Sends header, then size bytes of file_fd compressed on the fly
+ *         as a chunked body.  header must announce
+ *         Transfer-Encoding: chunked.
+ *
+ *  @return The number of bytes sent, or -1 on error, after which the
+ *          response is incomplete and the connection must be closed.
+ */
+ssize_t gzip_send_file(
+    int client_fd, const char *header, size_t header_length, int file_fd, size_t size);
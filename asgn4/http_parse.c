@@ -0,0 +1,374 @@
+#define _GNU_SOURCE
+#include "http_parse.h"
+#include <ctype.h>
+#include <string.h>
+#include <strings.h>
+
+static const str_view_t empty_view = { "", 0 };
+
+static bool view_equals(str_view_t view, const char *str) {
+    return view.len == strlen(str) && strncasecmp(view.ptr, str, view.len) == 0;
+}
+
+static bool is_uri_char(char ch) {
+    return isalnum((unsigned char) ch) || ch == '.' || ch == '-';
+}
+
+// Parses a non-negative decimal number, or returns -1
+static ssize_t parse_size(str_view_t value) {
+    if (value.len == 0 || value.len > 18)
+        return -1;
+    ssize_t n = 0;
+    for (size_t i = 0; i < value.len; i++) {
+        if (!isdigit((unsigned char) value.ptr[i]))
+            return -1;
+        n = n * 10 + (value.ptr[i] - '0');
+    }
+    return n;
+}
+
+// Reads one space terminated token of the request line starting at *i and
+// NUL terminates it in place.  Returns false if the token does not end in
+// the expected separator.
+static bool take_token(char *buf, size_t len, size_t *i, char separator, str_view_t *token) {
+    size_t start = *i;
+    size_t end = start;
+    while (end < len && buf[end] != ' ' && buf[end] != '\r' && buf[end] != '\n')
+        end++;
+    token->ptr = &buf[start];
+    token->len = end - start;
+    bool ok = end < len && buf[end] == separator;
+    if (ok && separator == '\r')
+        ok = end + 1 < len && buf[end + 1] == '\n';
+    // buf[len] is NUL, so terminating at end is always in bounds
+    buf[end] = '\0';
+    *i = ok ? end + 1 : end;
+    return ok;
+}
+
+static PARSE_RESULT check_request_line(http_request_t *req, bool well_formed) {
+    if (!well_formed || req->version.len != 8 || req->uri.len > MAX_URI_LENGTH
+        || req->uri.len < 2 || req->method.len > MAX_METHOD_LENGTH || req->uri.ptr[0] != '/')
+        return PARSE_BAD_REQUEST_LINE;
+    // Only GET may name the reserved path; to anything else it is a bad URI
+    bool reserved = req->method.len == 3 && memcmp(req->method.ptr, "GET", 3) == 0
+                    && req->uri.len == strlen(STATS_URI)
+                    && memcmp(req->uri.ptr, STATS_URI, req->uri.len) == 0;
+    for (size_t i = 1; i < req->uri.len && !reserved; i++)
+        if (!is_uri_char(req->uri.ptr[i]))
+            return PARSE_BAD_REQUEST_LINE;
+    if (memcmp(req->version.ptr, "HTTP/1.1", 8) != 0)
+        return PARSE_BAD_VERSION;
+    return PARSE_OK;
+}
+
+// Validates one "Key: value" line spanning buf[start, end) and records it
+static bool take_header(http_request_t *req, const char *buf, size_t start, size_t end) {
+    size_t colon = start;
+    while (colon < end && buf[colon] != ':') {
+        char ch = buf[colon];
+        if (!(isalnum((unsigned char) ch) || ch == '.' || ch == '-'))
+            return false;
+        colon++;
+    }
+    size_t key_len = colon - start;
+    // Exactly one space after the colon, then a non-empty value
+    if (key_len == 0 || key_len > MAX_HEADER_KEY_LENGTH || colon + 2 >= end
+        || buf[colon + 1] != ' ' || buf[colon + 2] == ' ')
+        return false;
+    for (size_t i = colon + 2; i < end; i++)
+        if (!isprint((unsigned char) buf[i]))
+            return false;
+
+    header_t header = { { &buf[start], key_len }, { &buf[colon + 2], end - colon - 2 } };
+    if (view_equals(header.key, "Content-Length")) {
+        req->content_length = parse_size(header.value);
+        if (req->content_length < 0)
+            return false;
+    } else if (view_equals(header.key, "Request-Id")) {
+        bool negative = header.value.ptr[0] == '-';
+        str_view_t digits = { header.value.ptr + negative, header.value.len - negative };
+        ssize_t id = parse_size(digits);
+        req->request_id = (id < 0) ? -1 : (negative ? -id : id);
+    } else if (view_equals(header.key, "Connection")) {
+        req->connection_close = view_equals(header.value, "close");
+    } else if (view_equals(header.key, "Transfer-Encoding")) {
+        req->chunked = view_equals(header.value, "chunked");
+    }
+    if (req->header_count < MAX_HEADERS)
+        req->headers[req->header_count] = header;
+    req->header_count++;
+    return true;
+}
+
+PARSE_RESULT http_parse_request(char *buf, size_t len, http_request_t *req) {
+    req->method = req->uri = req->version = empty_view;
+    req->content_length = -1;
+    req->request_id = -1;
+    req->connection_close = false;
+    req->chunked = false;
+    req->header_length = 0;
+    req->header_count = 0;
+
+    size_t i = 0;
+    bool well_formed = take_token(buf, len, &i, ' ', &req->method)
+                       && take_token(buf, len, &i, ' ', &req->uri)
+                       && take_token(buf, len, &i, '\r', &req->version);
+    if (well_formed) {
+        i++; // the '\n' after the version
+    } else {
+        // Skip whatever is left of the request line.  Its '\r' may already
+        // have been overwritten by take_token, so only look for the '\n'.
+        while (i + 1 < len && buf[i + 1] != '\n')
+            i++;
+        i += 2;
+    }
+    PARSE_RESULT line_result = check_request_line(req, well_formed);
+
+    // Header fields, up to the blank line.  Keep scanning past a bad field:
+    // a request that never ends its header is reported as a bad request line.
+    bool headers_ok = true;
+    while (i + 1 < len) {
+        if (buf[i] == '\r' && buf[i + 1] == '\n') {
+            req->header_length = i + 2;
+            break;
+        }
+        size_t start = i;
+        while (i + 1 < len && !(buf[i] == '\r' && buf[i + 1] == '\n'))
+            i++;
+        if (i + 1 >= len)
+            break;
+        if (headers_ok && !take_header(req, buf, start, i))
+            headers_ok = false;
+        i += 2;
+    }
+
+    if (req->header_length == 0)
+        return PARSE_BAD_REQUEST_LINE;
+    if (line_result != PARSE_OK)
+        return line_result;
+    return headers_ok ? PARSE_OK : PARSE_BAD_HEADER;
+}
+
+str_view_t http_find_header(const http_request_t *req, const char *key) {
+    size_t count = req->header_count < MAX_HEADERS ? req->header_count : MAX_HEADERS;
+    for (size_t i = 0; i < count; i++)
+        if (view_equals(req->headers[i].key, key))
+            return req->headers[i].value;
+    str_view_t missing = { NULL, 0 };
+    return missing;
+}
+
+RANGE_RESULT http_resolve_range(str_view_t value, size_t size, size_t *first, size_t *last) {
+    static const char unit[] = "bytes=";
+    size_t unit_length = sizeof(unit) - 1;
+    if (value.ptr == NULL || value.len < unit_length
+        || strncasecmp(value.ptr, unit, unit_length) != 0)
+        return RANGE_NONE;
+    const char *spec = value.ptr + unit_length;
+    size_t spec_length = value.len - unit_length;
+    const char *dash = (const char *) memchr(spec, '-', spec_length);
+    if (dash == NULL)
+        return RANGE_NONE;
+    str_view_t start = { spec, (size_t) (dash - spec) };
+    str_view_t end = { dash + 1, spec_length - start.len - 1 };
+    ssize_t to = parse_size(end);
+
+    if (start.len == 0) {
+        // A suffix range: the last `to` bytes
+        if (to < 0)
+            return RANGE_NONE;
+        if (to == 0 || size == 0)
+            return RANGE_UNSATISFIABLE;
+        *first = (size_t) to < size ? size - to : 0;
+        *last = size - 1;
+        return RANGE_OK;
+    }
+    ssize_t from = parse_size(start);
+    if (from < 0 || (end.len > 0 && (to < 0 || to < from)))
+        return RANGE_NONE;
+    if ((size_t) from >= size)
+        return RANGE_UNSATISFIABLE;
+    *first = from;
+    *last = end.len == 0 || (size_t) to >= size ? size - 1 : (size_t) to;
+    return RANGE_OK;
+}
+
+static str_view_t trim(const char *start, const char *end) {
+    while (start < end && (*start == ' ' || *start == '\t'))
+        start++;
+    while (end > start && (end[-1] == ' ' || end[-1] == '\t'))
+        end--;
+    return (str_view_t) { start, (size_t) (end - start) };
+}
+
+bool http_accepts_coding(str_view_t value, const char *coding) {
+    if (value.ptr == NULL)
+        return false;
+    const char *end = value.ptr + value.len;
+    const char *element = value.ptr;
+    while (element < end) {
+        const char *comma = memchr(element, ',', end - element);
+        const char *element_end = comma != NULL ? comma : end;
+        const char *semicolon = memchr(element, ';', element_end - element);
+        str_view_t name = trim(element, semicolon != NULL ? semicolon : element_end);
+        if (view_equals(name, coding)) {
+            if (semicolon == NULL)
+                return true;
+            // q=0, 0. or 0.000 turns the coding down; any other weight accepts it
+            str_view_t weight = trim(semicolon + 1, element_end);
+            if (weight.len < 2 || tolower((unsigned char) weight.ptr[0]) != 'q'
+                || weight.ptr[1] != '=')
+                return true;
+            for (size_t i = 2; i < weight.len; i++)
+                if (weight.ptr[i] != '0' && weight.ptr[i] != '.')
+                    return true;
+            return false;
+        }
+        element = element_end + 1;
+    }
+    return false;
+}
+
+bool http_etag_matches(str_view_t value, const char *etag) {
+    if (value.ptr == NULL)
+        return false;
+    size_t etag_length = strlen(etag);
+    const char *end = value.ptr + value.len;
+    const char *element = value.ptr;
+    while (element < end) {
+        const char *comma = memchr(element, ',', end - element);
+        const char *element_end = comma != NULL ? comma : end;
+        str_view_t tag = trim(element, element_end);
+        if (tag.len == 1 && tag.ptr[0] == '*')
+            return true;
+        if (tag.len > 2 && tag.ptr[0] == 'W' && tag.ptr[1] == '/') {
+            tag.ptr += 2;
+            tag.len -= 2;
+        }
+        if (tag.len == etag_length && memcmp(tag.ptr, etag, etag_length) == 0)
+            return true;
+        element = element_end + 1;
+    }
+    return false;
+}
+
+bool http_parse_date(str_view_t value, time_t *t) {
+    char date[64];
+    if (value.ptr == NULL || value.len >= sizeof(date))
+        return false;
+    memcpy(date, value.ptr, value.len);
+    date[value.len] = '\0';
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const char *end = strptime(date, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (end == NULL || *end != '\0')
+        return false;
+    *t = timegm(&tm);
+    return true;
+}
+
+void http_chunked_init(chunk_decoder_t *d) {
+    d->state = CHUNK_SIZE;
+    d->remaining = 0;
+    d->has_digits = false;
+}
+
+static int hex_value(char ch) {
+    if (ch >= '0' && ch <= '9')
+        return ch - '0';
+    ch = (char) tolower((unsigned char) ch);
+    return ch >= 'a' && ch <= 'f' ? ch - 'a' + 10 : -1;
+}
+
+// Moves the decoder past the framing byte ch.  Returns false if ch is not
+// allowed there.
+static bool chunked_step(chunk_decoder_t *d, char ch) {
+    switch (d->state) {
+    case CHUNK_SIZE: {
+        int digit = hex_value(ch);
+        if (digit >= 0) {
+            // Chunks of 2^60 bytes and up are surely not meant seriously
+            if (d->remaining >> 56)
+                return false;
+            d->remaining = d->remaining * 16 + digit;
+            d->has_digits = true;
+            return true;
+        }
+        if (!d->has_digits)
+            return false;
+        if (ch == ';' || ch == ' ' || ch == '\t')
+            d->state = CHUNK_EXTENSION;
+        else if (ch == '\r')
+            d->state = CHUNK_SIZE_LF;
+        else
+            return false;
+        return true;
+    }
+    case CHUNK_EXTENSION:
+        // Extensions are allowed and ignored
+        if (ch == '\r')
+            d->state = CHUNK_SIZE_LF;
+        return true;
+    case CHUNK_SIZE_LF:
+        if (ch != '\n')
+            return false;
+        d->state = d->remaining > 0 ? CHUNK_DATA : CHUNK_TRAILER;
+        d->has_digits = false;
+        return true;
+    case CHUNK_DATA_CR:
+        d->state = CHUNK_DATA_LF;
+        return ch == '\r';
+    case CHUNK_DATA_LF:
+        d->state = CHUNK_SIZE;
+        return ch == '\n';
+    case CHUNK_TRAILER:
+        // Trailer fields are skipped; a blank line ends the body
+        d->state = ch == '\r' ? CHUNK_END_LF : CHUNK_TRAILER_LINE;
+        return true;
+    case CHUNK_TRAILER_LINE:
+        if (ch == '\r')
+            d->state = CHUNK_TRAILER_LF;
+        return true;
+    case CHUNK_TRAILER_LF:
+        d->state = CHUNK_TRAILER;
+        return ch == '\n';
+    case CHUNK_END_LF:
+        d->state = CHUNK_DONE;
+        return ch == '\n';
+    default:
+        return false;
+    }
+}
+
+ssize_t http_chunked_decode(chunk_decoder_t *d, char *buf, size_t len, size_t *used) {
+    size_t in = 0, out = 0;
+    while (in < len && d->state != CHUNK_DONE) {
+        if (d->state == CHUNK_DATA) {
+            size_t count = len - in < d->remaining ? len - in : d->remaining;
+            memmove(buf + out, buf + in, count);
+            in += count;
+            out += count;
+            http_chunked_skip(d, count);
+            continue;
+        }
+        if (!chunked_step(d, buf[in++]))
+            return -1;
+    }
+    *used = in;
+    return out;
+}
+
+size_t http_chunked_pending(const chunk_decoder_t *d) {
+    return d->state == CHUNK_DATA ? d->remaining : 0;
+}
+
+void http_chunked_skip(chunk_decoder_t *d, size_t count) {
+    d->remaining -= count;
+    if (d->remaining == 0)
+        d->state = CHUNK_DATA_CR;
+}
+
+bool http_chunked_done(const chunk_decoder_t *d) {
+    return d->state == CHUNK_DONE;
+}
@@ -0,0 +1,174 @@
+/**
+ * @File http_parse.h
+ *
+ * Single pass HTTP/1.1 request header parser.  The parser never
+ * allocates: every field it returns points into the buffer it was given.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+
+#define MAX_HEADER_KEY_LENGTH 128
+#define MAX_URI_LENGTH        64
+#define MAX_METHOD_LENGTH     8
+#define MAX_HEADERS           32
+
+// Reserved path for the server's statistics.  '_' is not otherwise allowed
+// in a URI, and the parser accepts this path only with GET, so it can never
+// name a file.
+#define STATS_URI "/_stats"
+
+typedef enum {
+    PARSE_OK,
+    PARSE_BAD_REQUEST_LINE, // 400, malformed request line or URI
+    PARSE_BAD_VERSION, // 505, well formed but not HTTP/1.1
+    PARSE_BAD_HEADER, // 400, malformed header field or no blank line
+} PARSE_RESULT;
+
+/** @struct str_view_t
+ *  @brief A length delimited slice of the request buffer.
+ */
+typedef struct {
+    const char *ptr;
+    size_t len;
+} str_view_t;
+
+typedef struct {
+    str_view_t key;
+    str_view_t value;
+} header_t;
+
+/** @struct http_request_t
+ *  @brief The parsed request.  method, uri and version are also NUL
+ *         terminated in place so they can be used as C strings.
+ */
+typedef struct {
+    str_view_t method;
+    str_view_t uri;
+    str_view_t version;
+    // -1 if the header is absent
+    ssize_t content_length;
+    ssize_t request_id;
+    bool connection_close;
+    // Transfer-Encoding is exactly "chunked"
+    bool chunked;
+    // Bytes up to and including the blank line that ends the header
+    size_t header_length;
+    // The first MAX_HEADERS header fields; header_count may be larger
+    header_t headers[MAX_HEADERS];
+    size_t header_count;
+} http_request_t;
+
+/** @brief Parses and validates the request header at the start of buf.
+ *
+ *  @param buf The received bytes, followed by a NUL at buf[len].  The
+ *             separators after the method, URI and version are
+ *             overwritten with NULs.
+ *
+ *  @param len The number of bytes in buf.
+ *
+ *  @param req Filled with the parsed request.  method, uri and version
+ *             are always set (possibly empty) so errors can be logged.
+ *
+ *  @return PARSE_OK, or the reason the request is invalid.
+ */
+PARSE_RESULT http_parse_request(char *buf, size_t len, http_request_t *req);
+
+/** @brief Looks up a header by case-insensitive name.
+ *
+ *  @return the header value, or a view with a NULL ptr if absent.
+ */
+str_view_t http_find_header(const http_request_t *req, const char *key);
+
+/** @brief Whether an Accept-Encoding header value accepts the content
+ *         coding, i.e. names it without q=0.  Only exact names count, not
+ *         "*".  False for a missing header.
+ */
+bool http_accepts_coding(str_view_t value, const char *coding);
+
+/** @brief Whether an If-None-Match header value lists etag, or is "*".
+ *         Tags are compared weakly, ignoring a W/ prefix, as RFC 9110
+ *         asks for If-None-Match.
+ */
+bool http_etag_matches(str_view_t value, const char *etag);
+
+/** @brief Parses an IMF-fixdate such as "Sun, 06 Nov 1994 08:49:37 GMT".
+ *
+ *  @return true and sets *t if value is a date in that format.
+ */
+bool http_parse_date(str_view_t value, time_t *t);
+
+typedef enum {
+    CHUNK_SIZE,
+    CHUNK_EXTENSION,
+    CHUNK_SIZE_LF,
+    CHUNK_DATA,
+    CHUNK_DATA_CR,
+    CHUNK_DATA_LF,
+    CHUNK_TRAILER,
+    CHUNK_TRAILER_LINE,
+    CHUNK_TRAILER_LF,
+    CHUNK_END_LF,
+    CHUNK_DONE,
+} CHUNK_STATE;
+
+/** @struct chunk_decoder_t
+ *  @brief Where a chunked body decoder is in the body.  Data bytes can
+ *         arrive in any number of pieces, and the decoder keeps no more
+ *         than this state between them.
+ */
+typedef struct {
+    CHUNK_STATE state;
+    // Data bytes still to come in the current chunk, or its size so far
+    // while in CHUNK_SIZE
+    size_t remaining;
+    bool has_digits;
+} chunk_decoder_t;
+
+/** @brief Starts decoding a new chunked body.
+ */
+void http_chunked_init(chunk_decoder_t *d);
+
+/** @brief Decodes the next len bytes of a chunked body in place: the data
+ *         bytes among them are moved to the start of buf.  Stops right
+ *         after the blank line that ends the body, so the bytes of a
+ *         request pipelined behind it are left untouched.
+ *
+ *  @param used Set to the number of bytes of buf that were decoded.
+ *
+ *  @return The number of data bytes now at the start of buf, or -1 if
+ *          the encoding is malformed.
+ */
+ssize_t http_chunked_decode(chunk_decoder_t *d, char *buf, size_t len, size_t *used);
+
+/** @brief The number of data bytes the decoder expects before the next
+ *         framing, so a caller may receive them without decoding.
+ */
+size_t http_chunked_pending(const chunk_decoder_t *d);
+
+/** @brief Accounts for count of the pending data bytes, received by the
+ *         caller without going through http_chunked_decode.
+ */
+void http_chunked_skip(chunk_decoder_t *d, size_t count);
+
+/** @brief Whether the whole body has been decoded.
+ */
+bool http_chunked_done(const chunk_decoder_t *d);
+
+typedef enum { RANGE_NONE, RANGE_OK, RANGE_UNSATISFIABLE } RANGE_RESULT;
+
+/** @brief Resolves a Range header value against a body of size bytes.
+ *         Only a single "bytes=first-last", "bytes=first-" or
+ *         "bytes=-suffix" range is understood.  Anything else, including
+ *         a missing header, yields RANGE_NONE and the whole body should be
+ *         sent, as RFC 9110 allows.
+ *
+ *  @param first Set to the first byte of the range on RANGE_OK.
+ *
+ *  @param last Set to the last byte of the range (inclusive) on RANGE_OK.
+ */
+RANGE_RESULT http_resolve_range(str_view_t value, size_t size, size_t *first, size_t *last);
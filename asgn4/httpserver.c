@@ -1,435 +1,1260 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 #include <sys/stat.h>
-#include <ctype.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <errno.h>
 #include <pthread.h>
+#include <signal.h>
 #include <err.h>
 #include <bits/getopt_core.h>
 #include "rwlock.h"
 #include "queue.h"
 #include "asgn2_helper_funcs.h"
-
-#define MAX_HEADER_KEY_LENGTH   128
-#define MAX_HEADER_VALUE_LENGTH 128
-#define BUFFER_SIZE             2048
-static pthread_mutex_t listMutex;
+#include "reactor.h"
+#include "uri_table.h"
+#include "http_parse.h"
+#include "object_cache.h"
+#include "audit_log.h"
+#include "uring_io.h"
+#include "listener.h"
+#include "work_pool.h"
+#include "stats.h"
+#include "gzip.h"
+#include "map_cache.h"
+#include "arena.h"
+
+#define BUFFER_SIZE             CONN_BUFFER_SIZE
+#define QUEUE_DEPTH             1024
+#define PIPE_SIZE               (1 << 20)
+// Files at least this large and too large for the object cache are sent
+// from a shared mapping
+#define MAP_MIN_SIZE            (64 << 10)
+// A queued connection that waited this long adds a worker, if below the maximum
+#define GROW_WAIT_NS            (10 * 1000000ULL)
+// Seconds workers must have been spare before they are retired
+#define RETIRE_COOLDOWN         5
 
 int num_threads = 4;
-
-typedef struct node {
-    int conn_fd;
-    char *uri;
-    struct node *next;
-    rwlock_t *rwlock;
-} node_t;
-
-typedef struct list {
-    node_t *head;
-    node_t *tail;
-} list_t;
+int max_threads = 4;
+int keepalive_timeout = 5;
+int max_requests = 100;
+size_t cache_budget = 64 << 20;
+size_t gzip_cache_budget = 16 << 20;
+size_t map_cache_budget = (size_t) 1 << 30;
+int log_flush_ms = 5;
+int log_buffer_records = 4096;
+bool use_uring = false;
+bool reuse_port = false;
+bool work_stealing = false;
 
 typedef struct threadArgs {
-    list_t *list;
+    uri_table_t *table;
+    object_cache_t *cache;
+    object_cache_t *gzip_cache;
+    map_cache_t *maps;
     queue_t *queue;
+    reactor_t *reactor;
+    work_pool_t *pool;
+    int worker;
 } threadArgs_t;
 
-node_t *searchNode(list_t *list, char *uri) {
-    node_t *temp = list->head;
-    for (; temp != NULL; temp = temp->next)
-        if (strcmp(temp->uri, uri) == 0)
-            return temp;
-    return temp;
-}
-
-node_t *insertNode(int conn_fd, list_t *list, char *uri) {
-    node_t *temp = malloc(sizeof(node_t));
-    temp->conn_fd = conn_fd;
-    temp->next = NULL;
-    temp->rwlock = rwlock_new(N_WAY, 1);
-    temp->uri = malloc(strlen(uri) + 1);
-    strcpy(temp->uri, uri);
-    if (list->head == NULL)
-        list->head = temp;
-    if (list->tail != NULL)
-        list->tail->next = temp;
-    list->tail = temp;
-    return temp;
-}
-
 void throwInvalidPort() {
     write(STDERR_FILENO, "Invalid Port\n", 13);
     exit(1);
 }
 
 void log_entry(const char *method, const char *uri, int status_code, ssize_t request_id) {
-    fprintf(stderr, "%s,%s,%d,%zd\n", method, uri, status_code, request_id);
-    fflush(stderr);
+    audit_log(method, uri, status_code, request_id);
+    stats_request(method, status_code);
+}
+
+// Writes all of buf to a client, counting what was sent.  Client sockets
+// have a send timeout, which keeps the kernel from restarting a write that
+// a signal or io_uring task work interrupts, so EINTR is retried here.
+ssize_t send_all(int client_fd, const char *buf, size_t count) {
+    size_t sent = 0;
+    while (sent < count) {
+        ssize_t written = write(client_fd, buf + sent, count - sent);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return -1;
+        stats_bytes(0, written);
+        sent += written;
+    }
+    return sent;
+}
+
+// Extra header announcing that the server closes the connection after this response
+const char *connection_header(conn_t *conn) {
+    return conn->keep_alive ? "" : "Connection: close\r\n";
 }
 
-void send_error_response(int client_fd, int status_code, const char *status) {
+void send_error_response(conn_t *conn, int status_code, const char *status) {
+    // After anything but a missing or forbidden file the rest of the request
+    // may still be unread, so the connection cannot be reused
+    if (status_code != 404 && status_code != 403)
+        conn->keep_alive = false;
     char response[1024];
-    snprintf(response, sizeof(response), "HTTP/1.1 %d %s\r\nContent-Length: %zu\r\n\r\n%s\n",
-        status_code, status, strlen(status) + 1, status);
+    snprintf(response, sizeof(response),
+        "HTTP/1.1 %d %s\r\nContent-Length: %zu\r\n%s\r\n%s\n", status_code, status,
+        strlen(status) + 1, connection_header(conn), status);
     // Send the response to the client
-    ssize_t bytes_sent = write_n_bytes(client_fd, response, strlen(response));
+    ssize_t bytes_sent = send_all(conn->fd, response, strlen(response));
     if (bytes_sent == -1) {
         perror("Error sending error response to client");
     }
 }
-int get_file_size(const char *filename) {
-    struct stat file_status;
-    if (stat(filename, &file_status) < 0) {
+// Streams count bytes of file_fd starting at offset to client_fd.  sendfile(2)
+// moves the data inside the kernel; the read/write loop through buffer is
+// only used when the kernel cannot sendfile from this file.
+ssize_t send_file_range(int client_fd, int file_fd, off_t offset, size_t count, char *buffer) {
+    size_t remaining = count;
+    while (remaining > 0) {
+        ssize_t sent = sendfile(client_fd, file_fd, &offset, remaining);
+        if (sent > 0) {
+            stats_bytes(0, sent);
+            remaining -= sent;
+            continue;
+        }
+        if (sent == -1 && errno == EINTR)
+            continue;
+        if (sent == -1 && (errno == EINVAL || errno == ENOSYS) && remaining == count)
+            break;
         return -1;
     }
-
-    return file_status.st_size;
+    while (remaining > 0) {
+        size_t chunk = remaining < BUFFER_SIZE ? remaining : BUFFER_SIZE;
+        ssize_t bytes_read = pread(file_fd, buffer, chunk, offset);
+        if (bytes_read <= 0)
+            return -1;
+        if (send_all(client_fd, buffer, bytes_read) < 0)
+            return -1;
+        offset += bytes_read;
+        remaining -= bytes_read;
+    }
+    return count;
 }
-void handle_get(
-    int client_fd, const char *uri, char *buffer, ssize_t bytes_read, ssize_t request_id) {
-
-    int file_size = get_file_size(&uri[1]);
 
-    struct stat status;
-    if (stat(uri + 1, &status) != 0) {
-        send_error_response(client_fd, 404, "Not Found");
-        log_entry("GET", uri, 404, request_id);
-        return;
-    }
-    if (!(status.st_mode & S_IRUSR) || S_ISDIR(status.st_mode)) {
-        send_error_response(client_fd, 403, "Forbidden");
-        log_entry("GET", uri, 403, request_id);
-        return;
+// Copies count bytes from the socket into file_fd with read/write.
+ssize_t copy_to_file(int client_fd, int file_fd, size_t count) {
+    char buffer[BUFFER_SIZE];
+    size_t remaining = count;
+    while (remaining > 0) {
+        size_t chunk = remaining < BUFFER_SIZE ? remaining : BUFFER_SIZE;
+        ssize_t bytes_read = read(client_fd, buffer, chunk);
+        if (bytes_read < 0 && errno == EINTR)
+            continue;
+        if (bytes_read < 0)
+            return -1;
+        if (bytes_read == 0)
+            break;
+        if (write_n_bytes(file_fd, buffer, bytes_read) < 0)
+            return -1;
+        remaining -= bytes_read;
     }
+    return count - remaining;
+}
 
-    // Open the file for reading
-    int file_fd = open(uri + 1, O_RDONLY);
-    if (file_fd == -1) {
-        // File not found
-        send_error_response(client_fd, 500, "Internal Server Error");
-        log_entry("GET", uri, 500, request_id);
-        return;
+// Moves count bytes from the socket into file_fd by splicing through a pipe,
+// so the body never crosses into user space.  Returns the number of bytes
+// stored (short if the client closed early), or -1 on error.
+ssize_t recv_file_range(int client_fd, int file_fd, size_t count) {
+    if (count <= BUFFER_SIZE)
+        return copy_to_file(client_fd, file_fd, count);
+
+    int pipe_fd[2];
+    if (pipe2(pipe_fd, O_CLOEXEC) == -1)
+        return copy_to_file(client_fd, file_fd, count);
+    fcntl(pipe_fd[1], F_SETPIPE_SZ, PIPE_SIZE);
+
+    size_t remaining = count;
+    ssize_t result = 0;
+    while (remaining > 0) {
+        ssize_t in_pipe = splice(client_fd, NULL, pipe_fd[1], NULL, remaining, SPLICE_F_MOVE);
+        if (in_pipe == 0)
+            break;
+        if (in_pipe < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EINVAL && remaining == count) {
+                // Socket splicing unsupported; nothing consumed yet
+                close(pipe_fd[0]);
+                close(pipe_fd[1]);
+                return copy_to_file(client_fd, file_fd, count);
+            }
+            result = -1;
+            break;
+        }
+        while (in_pipe > 0) {
+            ssize_t out = splice(pipe_fd[0], NULL, file_fd, NULL, in_pipe, SPLICE_F_MOVE);
+            if (out < 0 && errno == EINTR)
+                continue;
+            if (out <= 0) {
+                // The file system cannot take spliced pages; drain by hand
+                char buffer[BUFFER_SIZE];
+                ssize_t bytes_read = read(pipe_fd[0], buffer,
+                    in_pipe < BUFFER_SIZE ? (size_t) in_pipe : (size_t) BUFFER_SIZE);
+                if (bytes_read <= 0 || write_n_bytes(file_fd, buffer, bytes_read) < 0) {
+                    result = -1;
+                    break;
+                }
+                out = bytes_read;
+            }
+            in_pipe -= out;
+            remaining -= out;
+        }
+        if (result < 0)
+            break;
     }
+    close(pipe_fd[0]);
+    close(pipe_fd[1]);
+    return result < 0 ? -1 : (ssize_t) (count - remaining);
+}
 
-    // Send the success response with custom status phrase
+// File I/O goes through the calling worker's io_uring when there is one
+int open_file(uring_io_t *io, const char *path, int flags, mode_t mode) {
+    return io != NULL ? uring_io_open(io, path, flags, mode) : open(path, flags, mode);
+}
 
-    memset(buffer, '\0', BUFFER_SIZE);
-    char *response = "HTTP/1.1 200 OK\r\nContent-Length: %d\r\n\r\n";
-    sprintf(buffer, response, file_size);
-    log_entry("GET", uri, 200, request_id);
-    bytes_read = strlen(buffer);
+int close_file(uring_io_t *io, int fd, bool wait) {
+    return io != NULL ? uring_io_close(io, fd, wait) : close(fd);
+}
 
-    while (1) {
-        write_n_bytes(client_fd, buffer, bytes_read);
-        bytes_read = read_n_bytes(file_fd, buffer, BUFFER_SIZE);
-        if (bytes_read <= 0) {
-            break;
-        }
-    }
+ssize_t read_file(uring_io_t *io, int fd, char *buf, size_t count) {
+    return io != NULL ? uring_io_read(io, fd, buf, count, 0) : read_n_bytes(fd, buf, count);
+}
 
-    close(file_fd);
+ssize_t send_file_uring(uring_io_t *io, int client_fd, const char *header, size_t header_length,
+    int file_fd, off_t offset, size_t count) {
+    ssize_t sent
+        = uring_io_send_file(io, client_fd, header, header_length, file_fd, offset, count);
+    if (sent > 0)
+        stats_bytes(0, sent);
+    return sent;
 }
 
-void handle_put(int client_fd, const char *uri, char *buffer, ssize_t content_length,
-    ssize_t header_length, ssize_t bytes_received, ssize_t request_id) {
+void set_cork(int client_fd, int on) {
+    setsockopt(client_fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+}
 
-    // Check if the file already exists
-    bool file_exists = access(uri + 1, F_OK) != -1;
+// Writes out all of iov to the client, modifying iov along the way.  A
+// response cut off partway would leave the client unable to tell where the
+// next one starts, so a failure ends the connection.  Returns 0 or -1.
+int write_iov(conn_t *conn, struct iovec *iov, int count) {
+    struct iovec *next = iov;
+    while (count > 0) {
+        ssize_t written = writev(conn->fd, next, count);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            conn->keep_alive = false;
+            return -1;
+        }
+        stats_bytes(0, written);
+        while (count > 0 && (size_t) written >= next->iov_len) {
+            written -= next->iov_len;
+            next++;
+            count--;
+        }
+        if (count > 0) {
+            next->iov_base = (char *) next->iov_base + written;
+            next->iov_len -= written;
+        }
+    }
+    return 0;
+}
 
-    // Open the file for writing, creating it if it doesn't exist
-    int file_fd = open(uri + 1, O_WRONLY | O_CREAT | O_TRUNC, 0666);
-    if (file_fd == -1) {
-        // Error opening file
-        send_error_response(client_fd, 500, "Internal Server Error");
-        log_entry("PUT", uri, 500, request_id);
-        return;
+// Sends the header in buffer followed by count bytes of file_fd from offset,
+// reusing buffer (BUFFER_SIZE bytes) as scratch space once the header is
+// out.  Ends the connection if the response could not be sent in full.
+void send_file_body(conn_t *conn, char *buffer, size_t header_length, int file_fd, off_t offset,
+    size_t count) {
+    uring_io_t *io = uring_io_get();
+    ssize_t sent;
+    if (io != NULL) {
+        sent = send_file_uring(io, conn->fd, buffer, header_length, file_fd, offset, count);
+    } else {
+        // Cork the socket so the header shares a segment with the first body
+        // bytes, unless a pipelined batch already holds it corked
+        bool cork = !conn->corked;
+        if (cork)
+            set_cork(conn->fd, 1);
+        sent = send_all(conn->fd, buffer, header_length);
+        if (sent >= 0)
+            sent = send_file_range(conn->fd, file_fd, offset, count, buffer);
+        if (cork)
+            set_cork(conn->fd, 0);
     }
-    char *p = &buffer[header_length];
-    ssize_t bytes_to_write = 0;
-    while (content_length != 0) {
+    if (sent < 0)
+        conn->keep_alive = false;
+}
 
-        if (content_length < bytes_received)
-            bytes_to_write = content_length;
-        else
-            bytes_to_write = bytes_received;
+// A strong ETag for the file's current contents.  A PUT renames a new file
+// into place, so the inode changes along with any change of contents.
+// suffix tells apart the representations of the same contents.
+void format_etag(const struct stat *status, const char *suffix, char *etag, size_t size) {
+    snprintf(etag, size, "\"%lx-%lx-%lx.%lx%s\"", (unsigned long) status->st_ino,
+        (unsigned long) status->st_size, (unsigned long) status->st_mtim.tv_sec,
+        (unsigned long) status->st_mtim.tv_nsec, suffix);
+}
 
-        ssize_t bytes_written = write_n_bytes(file_fd, p, bytes_to_write);
+// The ETag and Last-Modified header lines for the file
+void format_validators(const struct stat *status, const char *suffix, char *fields, size_t size) {
+    char etag[64];
+    format_etag(status, suffix, etag, sizeof(etag));
+    struct tm tm;
+    gmtime_r(&status->st_mtim.tv_sec, &tm);
+    char date[64];
+    strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    snprintf(fields, size, "ETag: %s\r\nLast-Modified: %s\r\n", etag, date);
+}
 
-        if (bytes_written < 0) {
-            close(file_fd);
-            send_error_response(client_fd, 500, "Internal Server Error");
-            log_entry("PUT", uri, 500, request_id);
-            return;
-        }
-        content_length -= bytes_written;
-        int bytes_to_read = 0;
-        if (content_length > BUFFER_SIZE)
-            bytes_to_read = BUFFER_SIZE;
-        else
-            bytes_to_read = content_length;
+// Sends a cached response, adding this connection's header fields between
+// the pre-rendered header and the body, in one writev where possible
+void send_cached_object(conn_t *conn, cached_object_t *obj) {
+    char fields[64];
+    int fields_length = snprintf(fields, sizeof(fields), "%s\r\n", connection_header(conn));
+    struct iovec iov[3] = {
+        { obj->data, obj->header_length },
+        { fields, fields_length },
+        { obj->data + obj->header_length, obj->body_length },
+    };
+    write_iov(conn, iov, 3);
+}
 
-        bytes_received = read_n_bytes(client_fd, buffer, bytes_to_read);
+// Reads a whole file into a new cache object and caches it.  Returns NULL
+// if the file did not read back at the size in status.
+cached_object_t *load_object(uring_io_t *io, object_cache_t *cache, const char *uri, int file_fd,
+    const struct stat *status) {
+    size_t file_size = status->st_size;
+    char validators[160];
+    format_validators(status, "", validators, sizeof(validators));
+    char header[256];
+    int header_length = snprintf(header, sizeof(header),
+        "HTTP/1.1 200 OK\r\nContent-Length: %zu\r\n%s", file_size, validators);
+    cached_object_t *obj = cached_object_new(header, header_length, file_size);
+    if (obj == NULL)
+        return NULL;
+    if (read_file(io, file_fd, obj->data + header_length, file_size) != (ssize_t) file_size) {
+        cached_object_release(obj);
+        return NULL;
+    }
+    object_cache_put(cache, uri, obj);
+    return obj;
+}
 
-        if (bytes_received == 0)
-            break;
-        if (bytes_received < 0) {
-            close(file_fd);
-            send_error_response(client_fd, 500, "Internal Server Error");
-            log_entry("PUT", uri, 500, request_id);
-            return;
-        }
+// Answers a GET carrying a Range header for a body of size bytes, sending
+// the slice from body if the body is in memory and from file_fd otherwise.
+// Returns false if the header is to be ignored and the whole body sent.
+bool send_range(conn_t *conn, const char *uri, ssize_t request_id, str_view_t range,
+    const char *body, int file_fd, size_t size) {
+    size_t first, last;
+    RANGE_RESULT result = http_resolve_range(range, size, &first, &last);
+    if (result == RANGE_NONE)
+        return false;
 
-        p = buffer;
+    char header[BUFFER_SIZE];
+    if (result == RANGE_UNSATISFIABLE) {
+        const char *message = "Range Not Satisfiable\n";
+        int response_length = snprintf(header, sizeof(header),
+            "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Length: %zu\r\n"
+            "Content-Range: bytes */%zu\r\n%s\r\n%s",
+            strlen(message), size, connection_header(conn), message);
+        log_entry("GET", uri, 416, request_id);
+        if (send_all(conn->fd, header, response_length) < 0)
+            conn->keep_alive = false;
+        return true;
     }
 
-    if (close(file_fd) == -1) {
-        // Error closing file
-        send_error_response(client_fd, 500, "Internal Server Error");
-        log_entry("PUT", uri, 500, request_id);
-        return;
+    size_t length = last - first + 1;
+    int header_length = snprintf(header, sizeof(header),
+        "HTTP/1.1 206 Partial Content\r\nContent-Length: %zu\r\n"
+        "Content-Range: bytes %zu-%zu/%zu\r\n%s\r\n",
+        length, first, last, size, connection_header(conn));
+    log_entry("GET", uri, 206, request_id);
+    if (body != NULL) {
+        struct iovec iov[2] = { { header, header_length }, { (char *) body + first, length } };
+        write_iov(conn, iov, 2);
+        return true;
     }
+    send_file_body(conn, header, header_length, file_fd, first, length);
+    return true;
+}
 
-    // Send the success response with appropriate status phrase
-    const char *status_phrase = file_exists ? "200 OK" : "201 Created";
-    const char *body = file_exists ? "OK\n" : "Created\n";
-    char formatted_response[256];
-    snprintf(formatted_response, sizeof(formatted_response),
-        "HTTP/1.1 %s\r\nContent-Length: %zd\r\n\r\n%s", status_phrase, strlen(body), body);
-
-    ssize_t bytes_written
-        = write_n_bytes(client_fd, formatted_response, strlen(formatted_response));
-    if (bytes_written < 0) {
-        send_error_response(client_fd, 500, "Internal Server Error");
-        log_entry("PUT", uri, 500, request_id);
-        close(client_fd);
-        return;
-    }
-    if (file_exists) {
-        log_entry("PUT", uri, 200, request_id);
+// Compresses the file open at file_fd into gzip_cache, reading it through
+// the plain cache when it fits there
+cached_object_t *compress_object(uring_io_t *io, object_cache_t *cache,
+    object_cache_t *gzip_cache, const char *uri, int file_fd, const struct stat *status) {
+    size_t size = status->st_size;
+    char validators[160];
+    format_validators(status, "-gzip", validators, sizeof(validators));
+    cached_object_t *plain = object_cache_get(cache, uri);
+    if (plain == NULL && size <= object_cache_max_object(cache))
+        plain = load_object(io, cache, uri, file_fd, status);
+    cached_object_t *obj = NULL;
+    if (plain != NULL) {
+        obj = gzip_object_new(
+            plain->data + plain->header_length, plain->body_length, validators);
+        cached_object_release(plain);
     } else {
-        log_entry("PUT", uri, 201, request_id);
+        char *body = (char *) arena_alloc(size);
+        if (body != NULL && read_file(io, file_fd, body, size) == (ssize_t) size)
+            obj = gzip_object_new(body, size, validators);
     }
+    if (obj != NULL)
+        object_cache_put(gzip_cache, uri, obj);
+    return obj;
 }
 
-void extract_request_info(const char *buffer, char **method, char **uri, char **version) {
-    // Allocate memory for method, uri, and version strings
-    *method = (char *) malloc(strlen(buffer) + 1);
-    *uri = (char *) malloc(strlen(buffer) + 1);
-    *version = (char *) malloc(strlen(buffer) + 1);
-
-    // Extract method, URI, and version from the buffer
-    sscanf(buffer, "%s %s %s", *method, *uri, *version);
+// Answers a GET from a client that accepts gzip with the compressed file:
+// from gzip_cache, compressing it there on first use, or compressed while
+// it is sent if it is too large for that cache.  Returns false if the file
+// is to be sent as is, including when it cannot be served at all, so that
+// the plain path answers with the error.
+bool send_gzip(conn_t *conn, object_cache_t *cache, object_cache_t *gzip_cache,
+    const char *uri, ssize_t request_id) {
+    cached_object_t *obj = object_cache_get(gzip_cache, uri);
+    if (obj == NULL) {
+        struct stat status;
+        if (stat(uri + 1, &status) != 0 || !(status.st_mode & S_IRUSR)
+            || S_ISDIR(status.st_mode) || status.st_size < GZIP_MIN_SIZE)
+            return false;
+        size_t size = status.st_size;
+        uring_io_t *io = uring_io_get();
+        int file_fd = open_file(io, uri + 1, O_RDONLY, 0);
+        if (file_fd == -1)
+            return false;
+        if (size > object_cache_max_object(gzip_cache)) {
+            char validators[160];
+            format_validators(&status, "-gzip", validators, sizeof(validators));
+            char header[BUFFER_SIZE];
+            int header_length = snprintf(header, sizeof(header),
+                "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\nContent-Encoding: gzip\r\n"
+                "Vary: Accept-Encoding\r\n%s%s\r\n",
+                validators, connection_header(conn));
+            log_entry("GET", uri, 200, request_id);
+            ssize_t sent = gzip_send_file(conn->fd, header, header_length, file_fd, size);
+            if (sent > 0)
+                stats_bytes(0, sent);
+            if (sent < 0)
+                conn->keep_alive = false;
+            close_file(io, file_fd, false);
+            return true;
+        }
+        obj = compress_object(io, cache, gzip_cache, uri, file_fd, &status);
+        close_file(io, file_fd, false);
+        if (obj == NULL)
+            return false;
+    }
+    if (gzip_object_is_marker(obj)) {
+        cached_object_release(obj);
+        return false;
+    }
+    log_entry("GET", uri, 200, request_id);
+    send_cached_object(conn, obj);
+    cached_object_release(obj);
+    return true;
 }
 
-ssize_t get_content_length(const char *request) {
-    const char *content_length_header = "Content-Length: ";
-    const char *content_length_start = strstr(request, content_length_header);
-    if (content_length_start == NULL) {
-        return -1; // Content-Length header not found
+// The ETag suffix of the representation send_gzip answers a GET with: "-gzip"
+// if it compresses the file, "" if it sends the file as it is.  NULL if that
+// is only known once the file has been compressed.
+const char *variant_suffix(
+    object_cache_t *gzip_cache, const char *uri, const struct stat *status, bool gzip) {
+    if (!gzip || status->st_size < GZIP_MIN_SIZE)
+        return "";
+    cached_object_t *obj = object_cache_get(gzip_cache, uri);
+    if (obj != NULL) {
+        // Incompressible files are cached as markers and sent as they are
+        bool marker = gzip_object_is_marker(obj);
+        cached_object_release(obj);
+        return marker ? "" : "-gzip";
     }
-
-    content_length_start += strlen(content_length_header);
-    ssize_t content_length;
-    sscanf(content_length_start, "%zd", &content_length);
-    return content_length;
+    // Too large for the cache: always compressed while sent
+    return (size_t) status->st_size > object_cache_max_object(gzip_cache) ? "-gzip" : NULL;
 }
 
-ssize_t get_request_id(const char *request) {
-    const char *request_id_header = "Request-Id: ";
-    const char *request_id_start = strstr(request, request_id_header);
-    if (request_id_start == NULL) {
-        return -1; // Content-Length header not found
+// Answers a conditional GET whose validators still match the file with a
+// 304, without opening the file.  The 304 carries the same ETag and Vary as
+// the 200 would.  Returns false if the request has to be served in full (or
+// answered with an error).
+bool send_not_modified(
+    conn_t *conn, object_cache_t *gzip_cache, const http_request_t *req, bool gzip) {
+    const char *uri = req->uri.ptr;
+    str_view_t if_none_match = http_find_header(req, "If-None-Match");
+    str_view_t if_modified_since = http_find_header(req, "If-Modified-Since");
+    if (if_none_match.ptr == NULL && if_modified_since.ptr == NULL)
+        return false;
+    struct stat status;
+    if (stat(uri + 1, &status) != 0 || !(status.st_mode & S_IRUSR) || S_ISDIR(status.st_mode))
+        return false;
+
+    // The gzip variant has its own tag for the same contents, and only the
+    // tag of the variant this client would be sent can match
+    const char *suffix = variant_suffix(gzip_cache, uri, &status, gzip);
+    if (suffix == NULL)
+        return false;
+    bool unchanged;
+    if (if_none_match.ptr != NULL) {
+        // If-Modified-Since is ignored when If-None-Match is present
+        char etag[64];
+        format_etag(&status, suffix, etag, sizeof(etag));
+        unchanged = http_etag_matches(if_none_match, etag);
+    } else {
+        time_t since;
+        unchanged = http_parse_date(if_modified_since, &since) && status.st_mtime <= since;
     }
+    if (!unchanged)
+        return false;
 
-    request_id_start += strlen(request_id_header);
-    ssize_t request_id;
-    sscanf(request_id_start, "%zd", &request_id);
-    return request_id;
+    char validators[160];
+    format_validators(&status, suffix, validators, sizeof(validators));
+    char header[512];
+    int header_length = snprintf(header, sizeof(header), "HTTP/1.1 304 Not Modified\r\n%s%s%s\r\n",
+        validators, suffix[0] != '\0' ? "Vary: Accept-Encoding\r\n" : "", connection_header(conn));
+    log_entry("GET", uri, 304, req->request_id);
+    if (send_all(conn->fd, header, header_length) < 0)
+        conn->keep_alive = false;
+    return true;
 }
 
-void free_mem(char *method, char *uri, char *version) {
-    free(method);
-    free(uri);
-    free(version);
-    return;
+// Answers a GET of a file too large for the object cache from its shared
+// mapping, with writev in place of sendfile.  Returns false if the file is
+// not mapped and is to be sent from a descriptor instead.
+bool send_mapped(conn_t *conn, map_cache_t *maps, const http_request_t *req,
+    str_view_t range, const struct stat *status) {
+    const char *uri = req->uri.ptr;
+    mapped_file_t *map = map_cache_get(maps, uri, status);
+    if (map == NULL)
+        return false;
+    if (range.ptr == NULL
+        || !send_range(conn, uri, req->request_id, range, map->data, -1, map->size)) {
+        char validators[160];
+        format_validators(status, "", validators, sizeof(validators));
+        char header[BUFFER_SIZE];
+        int header_length = snprintf(header, sizeof(header),
+            "HTTP/1.1 200 OK\r\nContent-Length: %zu\r\n%s%s\r\n", map->size, validators,
+            connection_header(conn));
+        log_entry("GET", uri, 200, req->request_id);
+        struct iovec iov[2] = { { header, header_length }, { map->data, map->size } };
+        write_iov(conn, iov, 2);
+    }
+    mapped_file_release(map);
+    return true;
 }
 
-bool is_valid_header_field(const char *header_field) {
-    char key[MAX_HEADER_KEY_LENGTH + 1];
-    char value[MAX_HEADER_VALUE_LENGTH + 1];
-
-    // Tokenize the header field
+void handle_get(conn_t *conn, threadArgs_t *args, const http_request_t *req) {
+    object_cache_t *cache = args->cache;
+    int client_fd = conn->fd;
+    const char *uri = req->uri.ptr;
+    ssize_t request_id = req->request_id;
+    str_view_t range = http_find_header(req, "Range");
+    // Ranges are only served from the plain body
+    str_view_t accept_encoding = http_find_header(req, "Accept-Encoding");
+    bool gzip = range.ptr == NULL && http_accepts_coding(accept_encoding, "gzip");
+    if (send_not_modified(conn, args->gzip_cache, req, gzip))
+        return;
+    cached_object_t *obj = object_cache_get(cache, uri);
+    // A cached body too small to compress goes out as it is, without a look
+    // at the gzip cache or a stat
+    if (gzip && (obj == NULL || obj->body_length >= GZIP_MIN_SIZE)
+        && send_gzip(conn, cache, args->gzip_cache, uri, request_id)) {
+        if (obj != NULL)
+            cached_object_release(obj);
+        return;
+    }
+    if (obj != NULL && range.ptr != NULL
+        && send_range(conn, uri, request_id, range, obj->data + obj->header_length, -1,
+            obj->body_length)) {
+        cached_object_release(obj);
+        return;
+    }
+    if (obj != NULL) {
+        log_entry("GET", uri, 200, request_id);
+        send_cached_object(conn, obj);
+        cached_object_release(obj);
+        return;
+    }
 
-    int num_tokens = sscanf(header_field, "%128[^:]: %128[^\r\n]", key, value);
+    struct stat status;
+    if (stat(uri + 1, &status) != 0) {
+        send_error_response(conn, 404, "Not Found");
+        log_entry("GET", uri, 404, request_id);
+        return;
+    }
+    if (!(status.st_mode & S_IRUSR) || S_ISDIR(status.st_mode)) {
+        send_error_response(conn, 403, "Forbidden");
+        log_entry("GET", uri, 403, request_id);
+        return;
+    }
+    // With io_uring large files go out through the ring rather than the mapping
+    uring_io_t *io = uring_io_get();
+    if (io == NULL && (size_t) status.st_size > object_cache_max_object(cache)
+        && status.st_size >= MAP_MIN_SIZE && send_mapped(conn, args->maps, req, range, &status))
+        return;
 
-    if (num_tokens != 2) {
-        return false;
+    // Open the file for reading
+    int file_fd = open_file(io, uri + 1, O_RDONLY, 0);
+    if (file_fd == -1) {
+        // File not found
+        send_error_response(conn, 500, "Internal Server Error");
+        log_entry("GET", uri, 500, request_id);
+        return;
     }
-    int value_start_index = strlen(key) + 2; // 2 is for ": "
-    if (!(value_start_index > 0 && header_field[value_start_index - 1] == ' '
-            && header_field[value_start_index] != ' '))
-        return false;
 
-    // Validate the key
-    for (int i = 0; key[i] != '\0'; ++i) {
-        if (!(isalnum(key[i]) || key[i] == '.' || key[i] == '-')) {
-            return false;
+    size_t file_size = status.st_size;
+    if (range.ptr != NULL && send_range(conn, uri, request_id, range, NULL, file_fd, file_size)) {
+        close_file(io, file_fd, false);
+        return;
+    }
+    if (file_size <= object_cache_max_object(cache)) {
+        obj = load_object(io, cache, uri, file_fd, &status);
+        if (obj != NULL) {
+            close_file(io, file_fd, false);
+            log_entry("GET", uri, 200, request_id);
+            send_cached_object(conn, obj);
+            cached_object_release(obj);
+            return;
         }
     }
-    if (strlen(key) > MAX_HEADER_KEY_LENGTH) {
-        // Key length exceeds the limit
-        return false;
+
+    // Send the success response with custom status phrase
+    char validators[160];
+    format_validators(&status, "", validators, sizeof(validators));
+    char buffer[BUFFER_SIZE];
+    int header_length = snprintf(buffer, sizeof(buffer),
+        "HTTP/1.1 200 OK\r\nContent-Length: %zu\r\n%s%s\r\n", file_size, validators,
+        connection_header(conn));
+    log_entry("GET", uri, 200, request_id);
+
+    if (file_size <= BUFFER_SIZE - (size_t) header_length) {
+        // Small files go out together with the header in a single write
+        ssize_t bytes_read = read_file(io, file_fd, buffer + header_length, file_size);
+        if (bytes_read != (ssize_t) file_size
+            || send_all(client_fd, buffer, header_length + bytes_read) < 0)
+            conn->keep_alive = false;
+    } else {
+        send_file_body(conn, buffer, header_length, file_fd, 0, file_size);
     }
 
-    // Validate the value
-    for (int i = 0; value[i] != '\0'; ++i) {
-        if (!isprint(value[i])) {
-            // Value contains non-printable characters
-            return false;
+    close_file(io, file_fd, false);
+}
+
+// Looks up the lock for uri, answering 500 if the registry is out of memory
+uri_entry_t *acquire_entry(
+    conn_t *conn, uri_table_t *table, const char *method, const char *uri, ssize_t request_id) {
+    uri_entry_t *node = uri_table_acquire(table, uri);
+    if (node == NULL) {
+        send_error_response(conn, 500, "Internal Server Error");
+        log_entry(method, uri, 500, request_id);
+    }
+    return node;
+}
+
+// Decodes a chunked body into file_fd as it arrives.  Once everything after
+// the header has been decoded, the whole connection buffer, header included,
+// is reused for the framing and for small chunks, so a header that fills the
+// buffer still leaves room for the body, and bytes of a pipelined request
+// that arrive with the end of the body are kept there.  The data of large
+// chunks goes straight to the file the same way as a body of known length.
+// The caller must not use the header afterwards.  Returns 0, or the status
+// code to answer with.
+int receive_chunked(conn_t *conn, uring_io_t *io, int file_fd) {
+    chunk_decoder_t decoder;
+    http_chunked_init(&decoder);
+    size_t start = conn->consumed;
+    off_t offset = 0;
+    while (1) {
+        size_t used;
+        ssize_t data = http_chunked_decode(&decoder, conn->buf + start, conn->len - start, &used);
+        if (data < 0)
+            return 400;
+        if (write_n_bytes(file_fd, conn->buf + start, data) < 0)
+            return 500;
+        offset += data;
+        start += used;
+        if (http_chunked_done(&decoder))
+            break;
+
+        size_t pending = http_chunked_pending(&decoder);
+        if (pending >= CONN_BUFFER_SIZE) {
+            ssize_t received;
+            if (io != NULL) {
+                received = uring_io_recv_file(io, conn->fd, file_fd, offset, pending);
+                // The ring writes at explicit offsets; later writes use the file position
+                lseek(file_fd, offset + (received > 0 ? received : 0), SEEK_SET);
+            } else {
+                received = recv_file_range(conn->fd, file_fd, pending);
+            }
+            if (received < 0 || (size_t) received < pending)
+                return received < 0 ? 500 : 400;
+            stats_bytes(received, 0);
+            http_chunked_skip(&decoder, pending);
+            offset += received;
+            continue;
         }
+        // Everything in the buffer has been decoded; refill all of it
+        stats_bytes(conn->len, 0);
+        start = conn->len = 0;
+        ssize_t n;
+        do {
+            n = recv(conn->fd, conn->buf + conn->len, CONN_BUFFER_SIZE - conn->len, 0);
+        } while (n < 0 && errno == EINTR);
+        if (n <= 0)
+            return n == 0 ? 400 : 500;
+        conn->len += n;
+        conn->buf[conn->len] = '\0';
     }
-    if (strlen(value) > MAX_HEADER_VALUE_LENGTH) {
-        // Value length exceeds the limit
-        return false;
+    conn->consumed = start;
+    return 0;
+}
+
+// Streams the request body into a new file at path.  A content_length of -1
+// means the body is chunked.  Returns 0, or the status code to answer with.
+int receive_body(conn_t *conn, uring_io_t *io, const char *path, char *buffer,
+    ssize_t content_length, ssize_t header_length, ssize_t bytes_received) {
+    int client_fd = conn->fd;
+    int file_fd = open_file(io, path, O_WRONLY | O_CREAT | O_EXCL, 0666);
+    if (file_fd == -1) {
+        return 500;
+    }
+    if (content_length < 0) {
+        int failure = receive_chunked(conn, io, file_fd);
+        if (close_file(io, file_fd, true) != 0 && failure == 0)
+            failure = 500;
+        return failure;
     }
+    // Body bytes that arrived together with the header go first
+    ssize_t buffered = bytes_received < content_length ? bytes_received : content_length;
+    int failure = 0;
+    if (write_n_bytes(file_fd, &buffer[header_length], buffered) < 0) {
+        failure = 500;
+    } else {
+        size_t remaining = content_length - buffered;
+        ssize_t received = io != NULL
+                               ? uring_io_recv_file(io, client_fd, file_fd, buffered, remaining)
+                               : recv_file_range(client_fd, file_fd, remaining);
+        if (received > 0)
+            stats_bytes(received, 0);
+        if (received < 0) {
+            failure = 500;
+        } else if ((size_t) received < remaining) {
+            // The client closed before the whole body arrived; never commit
+            // a partial upload
+            conn->keep_alive = false;
+            failure = 400;
+        }
+    }
+    if (failure != 0) {
+        close_file(io, file_fd, false);
+        return failure;
+    }
+    return close_file(io, file_fd, true) == 0 ? 0 : 500;
+}
 
-    // Header field is valid
-    return true;
+// Moves the uploaded file at temp_path over the target.  Called with the
+// writer lock held; returns the status code of the PUT.
+int commit_put(const char *uri, const char *temp_path) {
+    const char *path = uri + 1;
+    struct stat status;
+    bool file_exists = stat(path, &status) == 0;
+    if (file_exists) {
+        // Writing in place used to fail on a file we may not write to
+        if (access(path, W_OK) == -1)
+            return 500;
+        chmod(temp_path, status.st_mode & 07777);
+    }
+    if (rename(temp_path, path) == -1)
+        return 500;
+    return file_exists ? 200 : 201;
 }
-void process_request(int client_fd, list_t *list) {
-    char buffer[BUFFER_SIZE] = { '\0' };
-    int bytes_read = read_until(client_fd, buffer, BUFFER_SIZE, "\r\n\r\n");
-    char *method, *uri, *version;
-    // Extract method, URI, and version from the buffer
-    extract_request_info(buffer, &method, &uri, &version);
 
-    if (bytes_read < 0) {
-        send_error_response(client_fd, 500, "Internal Server Error");
-        log_entry("GET", uri, 500, 1);
+// The body is uploaded into a temporary file next to the target without
+// holding any lock, so GETs keep reading the old file in the meantime.
+// Only the rename that swaps the new file in happens under the writer lock.
+void handle_put(conn_t *conn, threadArgs_t *args, const char *request_uri, char *buffer,
+    ssize_t content_length, ssize_t header_length, ssize_t bytes_received, ssize_t request_id) {
+    uri_table_t *table = args->table;
+    static _Atomic unsigned long uploads = 0;
+    // A chunked body is received over the header, which holds request_uri
+    char uri[MAX_URI_LENGTH + 1];
+    snprintf(uri, sizeof(uri), "%s", request_uri);
+    // '~' cannot appear in a URI, so no request can reach a temporary file
+    char temp_path[MAX_URI_LENGTH + 48];
+    snprintf(temp_path, sizeof(temp_path), "%s~%d-%lu", uri + 1, (int) getpid(),
+        atomic_fetch_add(&uploads, 1));
+    int failure = receive_body(conn, uring_io_get(), temp_path, buffer, content_length,
+        header_length, bytes_received);
+
+    uri_entry_t *node = acquire_entry(conn, table, "PUT", uri, request_id);
+    if (node == NULL) {
+        unlink(temp_path);
+        return;
+    }
+    uint64_t wait_start = stats_now_ns();
+    writer_lock(node->rwlock);
+    stats_latency(LATENCY_LOCK_WAIT, stats_now_ns() - wait_start);
+    int status_code = failure == 0 ? commit_put(uri, temp_path) : failure;
+    // The new file's tag goes back to the client so it can cache the body it sent
+    char etag_field[96] = "";
+    if (status_code < 400) {
+        // Drop the cached copy before any reader can take the lock again
+        object_cache_invalidate(args->cache, uri);
+        object_cache_invalidate(args->gzip_cache, uri);
+        map_cache_invalidate(args->maps, uri);
+        struct stat status;
+        if (stat(uri + 1, &status) == 0) {
+            char etag[64];
+            format_etag(&status, "", etag, sizeof(etag));
+            snprintf(etag_field, sizeof(etag_field), "ETag: %s\r\n", etag);
+        }
+    }
+    log_entry("PUT", uri, status_code, request_id);
+    writer_unlock(node->rwlock);
+    uri_table_release(table, node);
+
+    if (status_code >= 400) {
+        unlink(temp_path);
+        send_error_response(
+            conn, status_code, status_code == 400 ? "Bad Request" : "Internal Server Error");
         return;
     }
+    // Send the success response with appropriate status phrase
+    const char *status_phrase = status_code == 200 ? "200 OK" : "201 Created";
+    const char *body = status_code == 200 ? "OK\n" : "Created\n";
+    char formatted_response[256];
+    snprintf(formatted_response, sizeof(formatted_response),
+        "HTTP/1.1 %s\r\nContent-Length: %zd\r\n%s%s\r\n%s", status_phrase, strlen(body),
+        etag_field, connection_header(conn), body);
+    if (send_all(conn->fd, formatted_response, strlen(formatted_response)) < 0)
+        conn->keep_alive = false;
+}
 
-    if (strlen(version) != 8 || strlen(uri) > 64 || strlen(uri) < 2 || strlen(method) > 8
-        || uri[0] != '/') {
-        send_error_response(client_fd, 400, "Bad Request");
-        log_entry("GET", uri, 400, 1);
-        free_mem(method, uri, version);
+// Answers GET /_stats with the counters of every thread summed up
+void handle_stats(conn_t *conn, ssize_t request_id) {
+    size_t size = 64 << 10;
+    char *body = (char *) arena_alloc(size);
+    size_t length = body != NULL ? stats_render(body, size) : size;
+    if (length >= size) {
+        send_error_response(conn, 500, "Internal Server Error");
+        log_entry("GET", STATS_URI, 500, request_id);
         return;
     }
+    log_entry("GET", STATS_URI, 200, request_id);
+    char header[128];
+    int header_length = snprintf(header, sizeof(header),
+        "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: %zu\r\n%s\r\n",
+        length, connection_header(conn));
+    struct iovec iov[2] = { { header, header_length }, { body, length } };
+    write_iov(conn, iov, 2);
+}
 
-    for (size_t i = 1; i < strlen(uri); ++i) {
-        char ch = uri[i];
-        if (!(isalnum(ch) || ch == '.' || ch == '-')) {
-            send_error_response(client_fd, 400, "Bad Request");
-            log_entry("GET", uri, 400, 1);
-            free_mem(method, uri, version);
-            return;
-        }
+void process_request(conn_t *conn, threadArgs_t *args) {
+    uri_table_t *table = args->table;
+    // The reactor has already read the header into the connection buffer
+    char *buffer = conn->buf;
+    int bytes_read = conn->len;
+    http_request_t req;
+    PARSE_RESULT result = http_parse_request(buffer, bytes_read, &req);
+    const char *method = req.method.ptr;
+    const char *uri = req.uri.ptr;
+
+    if (result == PARSE_BAD_REQUEST_LINE) {
+        send_error_response(conn, 400, "Bad Request");
+        log_entry("GET", uri, 400, 1);
+        return;
     }
-    if (strcmp(version, "HTTP/1.1") != 0) {
-        send_error_response(client_fd, 505, "Version Not Supported");
+    if (result == PARSE_BAD_VERSION) {
+        send_error_response(conn, 505, "Version Not Supported");
         log_entry("GET", uri, 505, 1);
-        free_mem(method, uri, version);
+        return;
+    }
+    if (result == PARSE_BAD_HEADER) {
+        send_error_response(conn, 400, "Bad Request");
+        stats_request(method, 400);
         return;
     }
 
-    ssize_t header_length = (strstr(buffer, "\r\n\r\n") + 4) - buffer;
-
+    ssize_t header_length = req.header_length;
     ssize_t remaining_bytes = bytes_read - header_length;
+    ssize_t content_length = req.content_length;
+    ssize_t request_id = req.request_id;
 
-    ssize_t content_length = get_content_length(buffer);
-    ssize_t request_id = get_request_id(buffer);
-    // Check validity of header fields
-    char *header_start = strstr(buffer, "\r\n") + 2; // Skip the request line
-    char *header_end = strstr(buffer, "\r\n\r\n") + 1;
-    char *header_field = strstr(header_start, "\r\n");
-    char *temp;
-    while (header_field != NULL && header_field < header_end) {
-
-        temp = (char *) malloc(header_field - header_start + 1);
-        memset(temp, '\0', header_field - header_start + 1);
-        memcpy(temp, header_start, header_field - header_start);
-        if (!(is_valid_header_field(temp))) {
-            send_error_response(client_fd, 400, "Bad Request");
-            free_mem(method, uri, version);
-            free(temp);
-            return;
-        }
-        free(temp);
-        header_start = header_field + 2;
-        header_field = strstr(header_start, "\r\n");
-    }
+    // A PUT takes the body bytes that arrived with its header; whatever
+    // follows belongs to the next request
+    ssize_t buffered_body = 0;
+    if (content_length > 0 && strcmp(method, "PUT") == 0)
+        buffered_body = remaining_bytes < content_length ? remaining_bytes : content_length;
+    conn->consumed = header_length + buffered_body;
+
+    // Only a PUT consumes a body, so any other request carrying one ends the connection
+    if (req.connection_close
+        || (strcmp(method, "PUT") != 0 && (content_length > 0 || req.chunked)))
+        conn->keep_alive = false;
 
-    pthread_mutex_lock(&listMutex);
-    node_t *node = searchNode(list, uri);
-    if (node == NULL) {
-        node = insertNode(client_fd, list, uri);
-    }
-    pthread_mutex_unlock(&listMutex);
     // Handle GET and PUT requests
-    if (strcmp(method, "GET") == 0) {
+    if (strcmp(method, "GET") == 0 && strcmp(uri, STATS_URI) == 0) {
+        handle_stats(conn, request_id);
+    } else if (strcmp(method, "GET") == 0) {
+        uri_entry_t *node = acquire_entry(conn, table, method, uri, request_id);
+        if (node == NULL) {
+            return;
+        }
+        uint64_t wait_start = stats_now_ns();
         reader_lock(node->rwlock);
-        // Handle GET request
+        stats_latency(LATENCY_LOCK_WAIT, stats_now_ns() - wait_start);
 
-        handle_get(client_fd, uri, buffer, bytes_read, request_id);
-        //log_entry("GET", uri, 200, "0"); // Log successful GET request
+        handle_get(conn, args, &req);
 
-        free_mem(method, uri, version);
         reader_unlock(node->rwlock);
+        uri_table_release(table, node);
     } else if (strcmp(method, "PUT") == 0) {
-        // Get the content length from the header
-        //ssize_t content_length = get_content_length(buffer);
-
-        if (content_length < 0) {
-            send_error_response(client_fd, 400, "Bad Request");
+        if (http_find_header(&req, "Transfer-Encoding").ptr != NULL && !req.chunked) {
+            send_error_response(conn, 501, "Not Implemented");
+            log_entry("PUT", uri, 501, request_id);
+            return;
+        }
+        // A body is either chunked or has a length, never both
+        if ((content_length < 0) == !req.chunked) {
+            send_error_response(conn, 400, "Bad Request");
             log_entry("PUT", uri, 400, request_id); // Log failed PUT request due to bad request
-            free_mem(method, uri, version);
             return;
         }
-        writer_lock(node->rwlock);
-
         // Handle the PUT request with the message body
-        handle_put(
-            client_fd, uri, buffer, content_length, header_length, remaining_bytes, request_id);
-        //log_entry("PUT", uri, 200, "0"); // Log successful PUT request
-        free_mem(method, uri, version);
-        writer_unlock(node->rwlock);
+        handle_put(conn, args, uri, buffer, content_length, header_length, remaining_bytes,
+            request_id);
     }
     //Handle unsupported method
     else {
-        send_error_response(client_fd, 501, "Not Implemented");
+        send_error_response(conn, 501, "Not Implemented");
         log_entry(method, uri, 501, request_id); // Log unsupported method
-        free_mem(method, uri, version);
     }
 }
+// Answers the request waiting on conn, and any requests the client has
+// pipelined behind it, then hands the connection back
+void serve_connection(conn_t *conn, threadArgs_t *threadArgs) {
+    uint64_t start = stats_now_ns();
+    stats_latency(LATENCY_QUEUE_WAIT, start - conn->dispatched_ns);
+    conn->corked = false;
+    while (1) {
+        conn->keep_alive = keepalive_timeout > 0 && ++conn->requests < max_requests;
+        conn->consumed = conn->len;
+        process_request(conn, threadArgs);
+        arena_reset();
+        stats_bytes(conn->consumed, 0);
+        stats_latency(LATENCY_SERVICE, stats_now_ns() - start);
+        if (!conn->keep_alive)
+            break;
+        // Carry the bytes after this request over to the next one
+        size_t leftover = conn->len - conn->consumed;
+        memmove(conn->buf, conn->buf + conn->consumed, leftover);
+        conn->len = leftover;
+        conn->buf[leftover] = '\0';
+        if (memmem(conn->buf, leftover, "\r\n\r\n", 4) == NULL)
+            break;
+        // Another request is already here; cork the socket so the responses
+        // to the whole batch go out in as few segments as possible
+        if (!conn->corked) {
+            set_cork(conn->fd, 1);
+            conn->corked = true;
+        }
+        start = stats_now_ns();
+    }
+    if (conn->corked)
+        set_cork(conn->fd, 0);
+    if (conn->keep_alive)
+        reactor_rearm(threadArgs->reactor, conn);
+    else
+        reactor_close(threadArgs->reactor, conn);
+}
+
+// Workers sharing the queue, between num_threads and max_threads
+_Atomic int pool_size = 0;
+// Workers waiting in queue_pop, and connections pushed but not yet popped
+_Atomic int idle_workers = 0;
+_Atomic int queued = 0;
+
+void *handle_request(void *args);
+
+// Starts another queue worker unless the pool is already at max_threads
+bool spawn_worker(threadArgs_t *threadArgs) {
+    int size = atomic_load(&pool_size);
+    do {
+        if (size >= max_threads)
+            return false;
+    } while (!atomic_compare_exchange_weak(&pool_size, &size, size + 1));
+    pthread_t t;
+    if (pthread_create(&t, NULL, handle_request, (void *) threadArgs) != 0) {
+        atomic_fetch_sub(&pool_size, 1);
+        return false;
+    }
+    pthread_detach(t);
+    stats_pool_size(size + 1);
+    return true;
+}
+
+// A NULL connection on the queue tells the worker that pops it to retire
 void *handle_request(void *args) {
     threadArgs_t *threadArgs = (threadArgs_t *) args;
-    list_t *list = threadArgs->list;
 
     while (1) {
-        uintptr_t conn_fd = -9999;
-        queue_pop(threadArgs->queue, (void **) &(conn_fd));
-        process_request(conn_fd, list);
-        close(conn_fd);
+        conn_t *conn = NULL;
+        atomic_fetch_add(&idle_workers, 1);
+        queue_pop(threadArgs->queue, (void **) &conn);
+        atomic_fetch_sub(&idle_workers, 1);
+        if (conn == NULL)
+            break;
+        atomic_fetch_sub(&queued, 1);
+        if (stats_now_ns() - conn->dispatched_ns >= GROW_WAIT_NS)
+            spawn_worker(threadArgs);
+        serve_connection(conn, threadArgs);
+    }
+    stats_pool_size(atomic_fetch_sub(&pool_size, 1) - 1);
+    audit_log_thread_exit();
+    uring_io_thread_exit();
+    stats_thread_exit();
+    arena_thread_exit();
+    return NULL;
+}
+
+// Adds a worker as soon as connections are queued that no idle worker can take
+void dispatch_request(conn_t *conn, void *arg) {
+    threadArgs_t *threadArgs = (threadArgs_t *) arg;
+    conn->dispatched_ns = stats_now_ns();
+    int waiting = atomic_fetch_add(&queued, 1) + 1;
+    queue_push(threadArgs->queue, conn);
+    if (waiting > atomic_load(&idle_workers))
+        spawn_worker(threadArgs);
+}
+
+// Retires the workers that stayed spare for a whole RETIRE_COOLDOWN,
+// never going below num_threads
+void *manage_pool(void *args) {
+    threadArgs_t *threadArgs = (threadArgs_t *) args;
+    const int ticks_per_window = RETIRE_COOLDOWN * 10;
+    int spare = max_threads;
+    int ticks = 0;
+    while (1) {
+        usleep(100000);
+        int idle = atomic_load(&idle_workers) - atomic_load(&queued);
+        if (idle < spare)
+            spare = idle;
+        if (++ticks < ticks_per_window)
+            continue;
+        int surplus = atomic_load(&pool_size) - num_threads;
+        for (int i = 0; i < spare && i < surplus; i++)
+            queue_push(threadArgs->queue, NULL);
+        spare = max_threads;
+        ticks = 0;
+    }
+    return NULL;
+}
+
+// In -s mode each worker takes connections from its own deque and steals
+// from its peers' when that is empty
+void *handle_local_request(void *args) {
+    threadArgs_t *threadArgs = (threadArgs_t *) args;
+
+    while (1) {
+        conn_t *conn = (conn_t *) work_pool_pop(threadArgs->pool, threadArgs->worker);
+        conn->worker = threadArgs->worker;
+        serve_connection(conn, threadArgs);
+    }
+}
+
+// New connections go round-robin; a kept-alive one goes back to the worker
+// that served it last, whose cache is still warm with it
+void dispatch_local(conn_t *conn, void *arg) {
+    static int next_worker = 0;
+    int worker = conn->worker;
+    conn->dispatched_ns = stats_now_ns();
+    if (worker < 0) {
+        worker = next_worker;
+        next_worker = (next_worker + 1) % num_threads;
+    }
+    work_pool_push((work_pool_t *) arg, worker, conn);
+}
+
+// Prints the work stealing counters to stdout whenever SIGUSR1 arrives
+void *report_work_stats(void *arg) {
+    work_pool_t *pool = (work_pool_t *) arg;
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    while (1) {
+        int sig;
+        if (sigwait(&set, &sig) != 0)
+            continue;
+        work_stats_t stats;
+        work_pool_stats(pool, &stats);
+        printf("local_hits %lu steal_attempts %lu steal_successes %lu\n",
+            (unsigned long) stats.local_hits, (unsigned long) stats.steal_attempts,
+            (unsigned long) stats.steal_successes);
+        fflush(stdout);
+    }
+    return NULL;
+}
+
+// shared holds the table and caches every worker uses
+void start_local_workers(Listener_Socket *listener, const threadArgs_t *shared) {
+    work_pool_t *pool = work_pool_new(num_threads, QUEUE_DEPTH);
+    if (pool == NULL) {
+        err(EXIT_FAILURE, "work_pool_new");
+    }
+    reactor_t *reactor = reactor_new(listener, dispatch_local, pool, keepalive_timeout);
+    if (reactor == NULL) {
+        err(EXIT_FAILURE, "reactor_new");
+    }
+    threadArgs_t *threadArgs = (threadArgs_t *) malloc(num_threads * sizeof(threadArgs_t));
+    if (threadArgs == NULL) {
+        err(EXIT_FAILURE, "malloc");
+    }
+    for (int i = 0; i < num_threads; i++) {
+        threadArgs[i] = *shared;
+        threadArgs[i].reactor = reactor;
+        threadArgs[i].pool = pool;
+        threadArgs[i].worker = i;
+        pthread_t t;
+        pthread_create(&t, NULL, handle_local_request, (void *) &threadArgs[i]);
+    }
+    pthread_t t;
+    pthread_create(&t, NULL, report_work_stats, (void *) pool);
+
+    reactor_run(reactor);
+}
+
+// In -r mode every worker runs its own reactor on its own SO_REUSEPORT
+// listener and answers requests on the reactor thread itself
+void serve_inline(conn_t *conn, void *arg) {
+    conn->dispatched_ns = stats_now_ns();
+    serve_connection(conn, (threadArgs_t *) arg);
+}
+
+void *run_reactor(void *args) {
+    reactor_run(((threadArgs_t *) args)->reactor);
+    return NULL;
+}
+
+// Sets up one listener and reactor per worker; the last one runs on the
+// calling thread
+void start_reuseport_workers(int port, const threadArgs_t *shared) {
+    for (int i = 0; i < num_threads; i++) {
+        Listener_Socket *listener = (Listener_Socket *) malloc(sizeof(Listener_Socket));
+        threadArgs_t *threadArgs = (threadArgs_t *) malloc(sizeof(threadArgs_t));
+        if (listener == NULL || threadArgs == NULL) {
+            err(EXIT_FAILURE, "malloc");
+        }
+        if (listener_init_reuseport(listener, port) == -1) {
+            throwInvalidPort();
+        }
+        *threadArgs = *shared;
+        threadArgs->worker = i;
+        threadArgs->reactor = reactor_new(listener, serve_inline, threadArgs, keepalive_timeout);
+        if (threadArgs->reactor == NULL) {
+            err(EXIT_FAILURE, "reactor_new");
+        }
+        if (i < num_threads - 1) {
+            pthread_t t;
+            pthread_create(&t, NULL, run_reactor, (void *) threadArgs);
+        } else {
+            run_reactor(threadArgs);
+        }
     }
 }
 
 int main(int argc, char *argv[]) {
     int option = 0;
-    while ((option = getopt(argc, argv, "t:")) != -1) {
+    while ((option = getopt(argc, argv, "t:k:m:c:g:M:f:b:urs")) != -1) {
         switch (option) {
-        case 't':
-            num_threads = atoi(optarg);
-            if (num_threads <= 0) {
+        case 't': {
+            // Either a fixed count or min:max for a pool that grows and shrinks
+            char *end;
+            num_threads = (int) strtol(optarg, &end, 10);
+            max_threads = *end == ':' ? (int) strtol(end + 1, &end, 10) : num_threads;
+            if (*end != '\0' || num_threads <= 0 || max_threads < num_threads) {
                 warnx("invalid thread size");
                 exit(EXIT_FAILURE);
             }
             break;
+        }
+        case 'k':
+            keepalive_timeout = atoi(optarg);
+            if (keepalive_timeout < 0) {
+                warnx("invalid keep-alive timeout");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'm':
+            max_requests = atoi(optarg);
+            if (max_requests <= 0) {
+                warnx("invalid max requests per connection");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'c': {
+            char *end;
+            cache_budget = strtoull(optarg, &end, 10);
+            if (*optarg == '-' || *end != '\0') {
+                warnx("invalid cache size");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        }
+        case 'g': {
+            char *end;
+            gzip_cache_budget = strtoull(optarg, &end, 10);
+            if (*optarg == '-' || *end != '\0') {
+                warnx("invalid gzip cache size");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        }
+        case 'M': {
+            char *end;
+            map_cache_budget = strtoull(optarg, &end, 10);
+            if (*optarg == '-' || *end != '\0') {
+                warnx("invalid map cache size");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        }
+        case 'f':
+            log_flush_ms = atoi(optarg);
+            if (log_flush_ms < 0) {
+                warnx("invalid log flush interval");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'b':
+            log_buffer_records = atoi(optarg);
+            if (log_buffer_records <= 0) {
+                warnx("invalid log buffer size");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'u':
+            use_uring = true;
+            break;
+        case 'r':
+            reuse_port = true;
+            break;
+        case 's':
+            work_stealing = true;
+            break;
         case '?':
-            if (optopt == 't') {
+            if (optopt == 't' || optopt == 'k' || optopt == 'm' || optopt == 'c' || optopt == 'g'
+                || optopt == 'M' || optopt == 'f' || optopt == 'b') {
                 fprintf(stderr, "Option -%c requires an argument.\n", optopt);
             } else {
                 fprintf(stderr, "Unknown option -%c\n", optopt);
@@ -448,29 +1273,66 @@ int main(int argc, char *argv[]) {
         throwInvalidPort();
     }
 
+    // Before any other thread exists, so that they all inherit the signal mask
+    if (work_stealing) {
+        sigset_t set;
+        sigemptyset(&set);
+        sigaddset(&set, SIGUSR1);
+        pthread_sigmask(SIG_BLOCK, &set, NULL);
+    }
+    if (audit_log_init(log_buffer_records, log_flush_ms) == -1) {
+        err(EXIT_FAILURE, "audit_log_init");
+    }
+
+    if (use_uring && !uring_io_init()) {
+        warnx("io_uring is not available, using blocking file I/O");
+    }
+
+    uri_table_t *table = uri_table_new();
+    if (table == NULL) {
+        err(EXIT_FAILURE, "uri_table_new");
+    }
+    threadArgs_t threadArgs;
+    threadArgs.table = table;
+    threadArgs.cache = object_cache_new(cache_budget);
+    threadArgs.gzip_cache = object_cache_new(gzip_cache_budget);
+    threadArgs.maps = map_cache_new(map_cache_budget);
+    threadArgs.queue = NULL;
+    threadArgs.reactor = NULL;
+    threadArgs.pool = NULL;
+    threadArgs.worker = -1;
+    if (reuse_port || work_stealing) {
+        // Only the shared queue's pool is elastic; the other modes run max_threads workers
+        num_threads = max_threads;
+        stats_pool_size(num_threads);
+    }
+    if (reuse_port) {
+        start_reuseport_workers(port, &threadArgs);
+        return 0;
+    }
+
     Listener_Socket listener;
     if (listener_init(&listener, port) == -1) {
         throwInvalidPort();
     }
-    queue_t *queue = queue_new(num_threads);
-    list_t list;
-    list.head = NULL;
-    list.tail = NULL;
-
-    threadArgs_t threadArgs;
-    threadArgs.list = &(list);
-    threadArgs.queue = queue;
+    if (work_stealing) {
+        start_local_workers(&listener, &threadArgs);
+        return 0;
+    }
+    threadArgs.queue = queue_new(QUEUE_DEPTH);
+    threadArgs.reactor = reactor_new(&listener, dispatch_request, &threadArgs, keepalive_timeout);
+    if (threadArgs.reactor == NULL) {
+        err(EXIT_FAILURE, "reactor_new");
+    }
 
     for (int i = 0; i < num_threads; i++) {
+        spawn_worker(&threadArgs);
+    }
+    if (max_threads > num_threads) {
         pthread_t t;
-        pthread_create(&t, NULL, handle_request, (void *) &threadArgs);
+        pthread_create(&t, NULL, manage_pool, (void *) &threadArgs);
     }
 
-    pthread_mutex_init(&listMutex, NULL);
-
-    while (1) {
-        int conn_fd = listener_accept(&listener);
-        queue_push(queue, (void *) (uintptr_t) conn_fd);
-    }
+    reactor_run(threadArgs.reactor);
     return 0;
 }
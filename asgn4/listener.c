@@ -0,0 +1,28 @@
+#include "listener.h"
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+int listener_init_reuseport(Listener_Socket *sock, int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    int on = 1;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    // SO_REUSEADDR lets a restarted server bind while old connections sit in TIME_WAIT
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == -1
+        || setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == -1
+        || bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1
+        || listen(fd, SOMAXCONN) == -1) {
+        close(fd);
+        return -1;
+    }
+    sock->fd = fd;
+    return 0;
+}
@@ -0,0 +1,23 @@
+/**
+ * @File listener.h
+ *
+ * Additions to the Listener_Socket interface from asgn2_helper_funcs.h.
+ */
+
+#pragma once
+
+#include "asgn2_helper_funcs.h"
+
+/** @brief Like listener_init, but sets SO_REUSEPORT so that several
+ *         sockets in this process can listen on the same port.  The
+ *         kernel spreads incoming connections across all of them.
+ *         Connections are still accepted with listener_accept.
+ *
+ *  @param sock The Listener_Socket to initialize.
+ *
+ *  @param port The port on which to listen.
+ *
+ *  @return 0, indicating success, or -1, indicating that it failed to
+ *          listen.
+ */
+int listener_init_reuseport(Listener_Socket *sock, int port);
@@ -0,0 +1,253 @@
+#include "map_cache.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "arena.h"
+#include "uri_table.h"
+
+#define BUCKET_COUNT 256
+#define MISSED_SLOTS 1024
+
+typedef struct map_entry {
+    uint64_t hash;
+    mapped_file_t *map;
+    struct map_entry *next;
+    // LRU list, most recently used at the head
+    struct map_entry *lru_prev;
+    struct map_entry *lru_next;
+    char uri[];
+} map_entry_t;
+
+// Large files are few and each GET of one sends many bytes, so a single
+// lock is enough here
+struct map_cache {
+    pthread_mutex_t mutex;
+    size_t budget;
+    size_t used;
+    map_entry_t *buckets[BUCKET_COUNT];
+    map_entry_t *lru_head;
+    map_entry_t *lru_tail;
+    // Hash of the last URI that missed in each slot
+    uint64_t missed[MISSED_SLOTS];
+};
+
+void mapped_file_release(mapped_file_t *m) {
+    if (atomic_fetch_sub(&m->refcount, 1) == 1) {
+        munmap(m->data, m->size);
+        free(m);
+    }
+}
+
+map_cache_t *map_cache_new(size_t budget) {
+    if (budget == 0) {
+        return NULL;
+    }
+    map_cache_t *c = (map_cache_t *) calloc(1, sizeof(map_cache_t));
+    if (c == NULL) {
+        return NULL;
+    }
+    pthread_mutex_init(&c->mutex, NULL);
+    c->budget = budget;
+    return c;
+}
+
+static void entry_free(map_entry_t *entry) {
+    mapped_file_release(entry->map);
+    free(entry);
+}
+
+void map_cache_delete(map_cache_t **c) {
+    if (c == NULL || *c == NULL) {
+        return;
+    }
+    map_entry_t *entry = (*c)->lru_head;
+    while (entry != NULL) {
+        map_entry_t *next = entry->lru_next;
+        entry_free(entry);
+        entry = next;
+    }
+    pthread_mutex_destroy(&(*c)->mutex);
+    free(*c);
+    *c = NULL;
+}
+
+static bool same_generation(const mapped_file_t *m, const struct stat *status) {
+    return m->dev == status->st_dev && m->ino == status->st_ino
+           && m->size == (size_t) status->st_size && m->mtime.tv_sec == status->st_mtim.tv_sec
+           && m->mtime.tv_nsec == status->st_mtim.tv_nsec;
+}
+
+static map_entry_t **bucket_for(map_cache_t *c, uint64_t hash) {
+    return &c->buckets[hash & (BUCKET_COUNT - 1)];
+}
+
+static map_entry_t *find(map_cache_t *c, uint64_t hash, const char *uri) {
+    map_entry_t *entry = *bucket_for(c, hash);
+    for (; entry != NULL; entry = entry->next)
+        if (entry->hash == hash && strcmp(entry->uri, uri) == 0)
+            return entry;
+    return NULL;
+}
+
+static void lru_unlink(map_cache_t *c, map_entry_t *entry) {
+    if (entry->lru_prev != NULL)
+        entry->lru_prev->lru_next = entry->lru_next;
+    else
+        c->lru_head = entry->lru_next;
+    if (entry->lru_next != NULL)
+        entry->lru_next->lru_prev = entry->lru_prev;
+    else
+        c->lru_tail = entry->lru_prev;
+}
+
+static void lru_push_front(map_cache_t *c, map_entry_t *entry) {
+    entry->lru_prev = NULL;
+    entry->lru_next = c->lru_head;
+    if (c->lru_head != NULL)
+        c->lru_head->lru_prev = entry;
+    else
+        c->lru_tail = entry;
+    c->lru_head = entry;
+}
+
+// Unlinks entry from the cache; the caller frees it outside the lock
+static void remove_entry(map_cache_t *c, map_entry_t *entry) {
+    map_entry_t **link = bucket_for(c, entry->hash);
+    while (*link != entry)
+        link = &(*link)->next;
+    *link = entry->next;
+    lru_unlink(c, entry);
+    c->used -= entry->map->size;
+}
+
+// Looks up uri and takes a reference on its mapping if it is still of the
+// generation in status.  A stale mapping is unlinked into *stale.
+static mapped_file_t *lookup(map_cache_t *c, uint64_t hash, const char *uri,
+    const struct stat *status, map_entry_t **stale) {
+    map_entry_t *entry = find(c, hash, uri);
+    if (entry == NULL)
+        return NULL;
+    if (!same_generation(entry->map, status)) {
+        remove_entry(c, entry);
+        entry->next = *stale;
+        *stale = entry;
+        return NULL;
+    }
+    atomic_fetch_add(&entry->map->refcount, 1);
+    if (c->lru_head != entry) {
+        lru_unlink(c, entry);
+        lru_push_front(c, entry);
+    }
+    return entry->map;
+}
+
+static mapped_file_t *map_file(const char *path, const struct stat *status) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return NULL;
+    struct stat opened;
+    mapped_file_t *m = NULL;
+    // The file may have changed between the caller's stat and the open
+    mapped_file_t expected = { .dev = status->st_dev, .ino = status->st_ino,
+        .mtime = status->st_mtim, .size = status->st_size };
+    if (fstat(fd, &opened) == 0 && same_generation(&expected, &opened) && opened.st_size > 0) {
+        void *data = mmap(NULL, opened.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (data != MAP_FAILED) {
+            madvise(data, opened.st_size, MADV_SEQUENTIAL);
+            madvise(data, opened.st_size, MADV_WILLNEED);
+            m = (mapped_file_t *) arena_heap_alloc(sizeof(mapped_file_t));
+            if (m == NULL) {
+                munmap(data, opened.st_size);
+            } else {
+                atomic_init(&m->refcount, 1);
+                m->dev = opened.st_dev;
+                m->ino = opened.st_ino;
+                m->mtime = opened.st_mtim;
+                m->size = opened.st_size;
+                m->data = (char *) data;
+            }
+        }
+    }
+    close(fd);
+    return m;
+}
+
+mapped_file_t *map_cache_get(map_cache_t *c, const char *uri, const struct stat *status) {
+    if (c == NULL || (size_t) status->st_size > c->budget) {
+        return NULL;
+    }
+    uint64_t hash = uri_hash(uri);
+    map_entry_t *evicted = NULL;
+    pthread_mutex_lock(&c->mutex);
+    mapped_file_t *m = lookup(c, hash, uri, status, &evicted);
+    // Only a file that has missed before is mapped, so a file fetched once
+    // never pins a mapping or evicts one that is in use
+    bool missed_before = true;
+    if (m == NULL) {
+        uint64_t *slot = &c->missed[hash & (MISSED_SLOTS - 1)];
+        missed_before = *slot == hash;
+        *slot = hash;
+    }
+    pthread_mutex_unlock(&c->mutex);
+
+    if (m == NULL && missed_before && (m = map_file(uri + 1, status)) != NULL) {
+        size_t length = strlen(uri);
+        map_entry_t *entry = (map_entry_t *) arena_heap_alloc(sizeof(map_entry_t) + length + 1);
+        if (entry != NULL) {
+            entry->hash = hash;
+            entry->map = m;
+            memcpy(entry->uri, uri, length + 1);
+            atomic_fetch_add(&m->refcount, 1);
+
+            pthread_mutex_lock(&c->mutex);
+            // Another reader may have mapped the file in the meantime
+            mapped_file_t *other = lookup(c, hash, uri, status, &evicted);
+            if (other != NULL) {
+                entry->next = evicted;
+                evicted = entry;
+                mapped_file_release(m);
+                m = other;
+            } else {
+                while (c->used + m->size > c->budget) {
+                    map_entry_t *victim = c->lru_tail;
+                    remove_entry(c, victim);
+                    victim->next = evicted;
+                    evicted = victim;
+                }
+                map_entry_t **bucket = bucket_for(c, hash);
+                entry->next = *bucket;
+                *bucket = entry;
+                lru_push_front(c, entry);
+                c->used += m->size;
+            }
+            pthread_mutex_unlock(&c->mutex);
+        }
+    }
+
+    while (evicted != NULL) {
+        map_entry_t *next = evicted->next;
+        entry_free(evicted);
+        evicted = next;
+    }
+    return m;
+}
+
+void map_cache_invalidate(map_cache_t *c, const char *uri) {
+    if (c == NULL) {
+        return;
+    }
+    uint64_t hash = uri_hash(uri);
+    pthread_mutex_lock(&c->mutex);
+    map_entry_t *entry = find(c, hash, uri);
+    if (entry != NULL)
+        remove_entry(c, entry);
+    pthread_mutex_unlock(&c->mutex);
+
+    if (entry != NULL)
+        entry_free(entry);
+}
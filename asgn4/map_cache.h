@@ -0,0 +1,65 @@
+/**
+ * @File map_cache.h
+ *
+ * Cache of read-only mappings of large files, keyed by URI and the
+ * file's generation (device, inode, size and mtime).  Concurrent GETs of
+ * the same file share one mapping, and so the same page cache pages,
+ * and send straight from it without any read system calls.
+ *
+ * A file is only mapped the second time it misses, so files fetched once
+ * are never mapped.
+ *
+ * Mappings are reference counted.  Retiring a URI only unlinks its
+ * mapping, which is unmapped once the last reader releases it.
+ */
+
+#pragma once
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+/** @struct mapped_file_t
+ *  @brief size bytes of a file mapped read-only at data.
+ */
+typedef struct mapped_file {
+    _Atomic int refcount;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    size_t size;
+    char *data;
+} mapped_file_t;
+
+typedef struct map_cache map_cache_t;
+
+/** @brief Dynamically allocates a cache keeping at most budget bytes of
+ *         files mapped.
+ *
+ *  @return a pointer to a new map_cache_t, or NULL if budget is 0 or
+ *          allocation failed.
+ */
+map_cache_t *map_cache_new(size_t budget);
+
+/** @brief Unmaps every mapping no reader holds any more and frees the
+ *         cache.  Sets *c to NULL.
+ */
+void map_cache_delete(map_cache_t **c);
+
+/** @brief Returns the mapping of the file at uri as described by status,
+ *         mapping it if the cache has none of that generation.
+ *
+ *  @return the mapping, to be released with mapped_file_release, or NULL
+ *          if this is the file's first miss, it could not be mapped, is
+ *          larger than the budget, or the cache is NULL.
+ */
+mapped_file_t *map_cache_get(map_cache_t *c, const char *uri, const struct stat *status);
+
+/** @brief Retires the mapping of uri.  Call with the URI's writer lock
+ *         held, after the file has changed.
+ */
+void map_cache_invalidate(map_cache_t *c, const char *uri);
+
+/** @brief Drops a reference, unmapping the file with the last one.
+ */
+void mapped_file_release(mapped_file_t *m);
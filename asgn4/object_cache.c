@@ -0,0 +1,238 @@
+#include "object_cache.h"
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+#include "uri_table.h"
+
+#define SHARD_COUNT   16
+#define BUCKET_COUNT  256
+// No single object may take more than this share of a shard's budget
+#define MAX_OBJECT_SHARE 4
+
+typedef struct cache_entry {
+    uint64_t hash;
+    size_t charge;
+    cached_object_t *obj;
+    struct cache_entry *next;
+    // LRU list, most recently used at the head
+    struct cache_entry *lru_prev;
+    struct cache_entry *lru_next;
+    char uri[];
+} cache_entry_t;
+
+typedef struct shard {
+    alignas(64) pthread_mutex_t mutex;
+    cache_entry_t *buckets[BUCKET_COUNT];
+    cache_entry_t *lru_head;
+    cache_entry_t *lru_tail;
+    size_t used;
+} shard_t;
+
+struct object_cache {
+    size_t shard_budget;
+    shard_t shards[SHARD_COUNT];
+};
+
+cached_object_t *cached_object_new(const char *header, size_t header_length, size_t body_length) {
+    cached_object_t *obj
+        = (cached_object_t *) arena_heap_alloc(sizeof(cached_object_t) + header_length + body_length);
+    if (obj == NULL) {
+        return NULL;
+    }
+    atomic_init(&obj->refcount, 1);
+    obj->header_length = header_length;
+    obj->body_length = body_length;
+    memcpy(obj->data, header, header_length);
+    return obj;
+}
+
+void cached_object_release(cached_object_t *obj) {
+    if (atomic_fetch_sub(&obj->refcount, 1) == 1)
+        free(obj);
+}
+
+object_cache_t *object_cache_new(size_t budget) {
+    if (budget == 0) {
+        return NULL;
+    }
+    object_cache_t *c = (object_cache_t *) aligned_alloc(64, sizeof(object_cache_t));
+    if (c == NULL) {
+        return NULL;
+    }
+    c->shard_budget = budget / SHARD_COUNT;
+    for (int i = 0; i < SHARD_COUNT; i++) {
+        shard_t *shard = &c->shards[i];
+        pthread_mutex_init(&shard->mutex, NULL);
+        memset(shard->buckets, 0, sizeof(shard->buckets));
+        shard->lru_head = shard->lru_tail = NULL;
+        shard->used = 0;
+    }
+    return c;
+}
+
+static void entry_free(cache_entry_t *entry) {
+    cached_object_release(entry->obj);
+    free(entry);
+}
+
+void object_cache_delete(object_cache_t **c) {
+    if (c == NULL || *c == NULL) {
+        return;
+    }
+    for (int i = 0; i < SHARD_COUNT; i++) {
+        shard_t *shard = &(*c)->shards[i];
+        cache_entry_t *entry = shard->lru_head;
+        while (entry != NULL) {
+            cache_entry_t *next = entry->lru_next;
+            entry_free(entry);
+            entry = next;
+        }
+        pthread_mutex_destroy(&shard->mutex);
+    }
+    free(*c);
+    *c = NULL;
+}
+
+size_t object_cache_max_object(object_cache_t *c) {
+    return c == NULL ? 0 : c->shard_budget / MAX_OBJECT_SHARE;
+}
+
+static shard_t *shard_for(object_cache_t *c, uint64_t hash) {
+    return &c->shards[hash & (SHARD_COUNT - 1)];
+}
+
+static cache_entry_t **bucket_for(shard_t *shard, uint64_t hash) {
+    return &shard->buckets[(hash >> 4) & (BUCKET_COUNT - 1)];
+}
+
+static cache_entry_t *find(shard_t *shard, uint64_t hash, const char *uri) {
+    cache_entry_t *entry = *bucket_for(shard, hash);
+    for (; entry != NULL; entry = entry->next)
+        if (entry->hash == hash && strcmp(entry->uri, uri) == 0)
+            return entry;
+    return NULL;
+}
+
+static void lru_unlink(shard_t *shard, cache_entry_t *entry) {
+    if (entry->lru_prev != NULL)
+        entry->lru_prev->lru_next = entry->lru_next;
+    else
+        shard->lru_head = entry->lru_next;
+    if (entry->lru_next != NULL)
+        entry->lru_next->lru_prev = entry->lru_prev;
+    else
+        shard->lru_tail = entry->lru_prev;
+}
+
+static void lru_push_front(shard_t *shard, cache_entry_t *entry) {
+    entry->lru_prev = NULL;
+    entry->lru_next = shard->lru_head;
+    if (shard->lru_head != NULL)
+        shard->lru_head->lru_prev = entry;
+    else
+        shard->lru_tail = entry;
+    shard->lru_head = entry;
+}
+
+// Unlinks entry from its shard; the caller frees it outside the lock
+static void remove_entry(shard_t *shard, cache_entry_t *entry) {
+    cache_entry_t **link = bucket_for(shard, entry->hash);
+    while (*link != entry)
+        link = &(*link)->next;
+    *link = entry->next;
+    lru_unlink(shard, entry);
+    shard->used -= entry->charge;
+}
+
+cached_object_t *object_cache_get(object_cache_t *c, const char *uri) {
+    if (c == NULL) {
+        return NULL;
+    }
+    uint64_t hash = uri_hash(uri);
+    shard_t *shard = shard_for(c, hash);
+
+    pthread_mutex_lock(&shard->mutex);
+    cache_entry_t *entry = find(shard, hash, uri);
+    cached_object_t *obj = NULL;
+    if (entry != NULL) {
+        obj = entry->obj;
+        atomic_fetch_add(&obj->refcount, 1);
+        if (shard->lru_head != entry) {
+            lru_unlink(shard, entry);
+            lru_push_front(shard, entry);
+        }
+    }
+    pthread_mutex_unlock(&shard->mutex);
+    return obj;
+}
+
+void object_cache_put(object_cache_t *c, const char *uri, cached_object_t *obj) {
+    if (c == NULL) {
+        return;
+    }
+    size_t length = strlen(uri);
+    size_t charge = sizeof(cache_entry_t) + length + 1 + sizeof(cached_object_t)
+                    + obj->header_length + obj->body_length;
+    if (charge > c->shard_budget) {
+        return;
+    }
+    cache_entry_t *entry = (cache_entry_t *) arena_heap_alloc(sizeof(cache_entry_t) + length + 1);
+    if (entry == NULL) {
+        return;
+    }
+    uint64_t hash = uri_hash(uri);
+    entry->hash = hash;
+    entry->charge = charge;
+    entry->obj = obj;
+    atomic_fetch_add(&obj->refcount, 1);
+    memcpy(entry->uri, uri, length + 1);
+
+    shard_t *shard = shard_for(c, hash);
+    cache_entry_t *evicted = NULL;
+
+    pthread_mutex_lock(&shard->mutex);
+    cache_entry_t *old = find(shard, hash, uri);
+    if (old != NULL) {
+        remove_entry(shard, old);
+        old->next = evicted;
+        evicted = old;
+    }
+    while (shard->used + charge > c->shard_budget) {
+        cache_entry_t *victim = shard->lru_tail;
+        remove_entry(shard, victim);
+        victim->next = evicted;
+        evicted = victim;
+    }
+    cache_entry_t **bucket = bucket_for(shard, hash);
+    entry->next = *bucket;
+    *bucket = entry;
+    lru_push_front(shard, entry);
+    shard->used += charge;
+    pthread_mutex_unlock(&shard->mutex);
+
+    while (evicted != NULL) {
+        cache_entry_t *next = evicted->next;
+        entry_free(evicted);
+        evicted = next;
+    }
+}
+
+void object_cache_invalidate(object_cache_t *c, const char *uri) {
+    if (c == NULL) {
+        return;
+    }
+    uint64_t hash = uri_hash(uri);
+    shard_t *shard = shard_for(c, hash);
+
+    pthread_mutex_lock(&shard->mutex);
+    cache_entry_t *entry = find(shard, hash, uri);
+    if (entry != NULL)
+        remove_entry(shard, entry);
+    pthread_mutex_unlock(&shard->mutex);
+
+    if (entry != NULL)
+        entry_free(entry);
+}
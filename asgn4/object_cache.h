@@ -0,0 +1,74 @@
+/**
+ * @File object_cache.h
+ *
+ * Bounded in-memory cache of small files, keyed by URI.  Each cached
+ * object holds the rendered response header followed by the file body,
+ * so a GET hit is served without touching the file system.
+ *
+ * Objects are immutable and reference counted.  Replacing or
+ * invalidating a URI only unlinks the old object, so a reader that
+ * already holds it keeps a complete copy until it releases it.
+ */
+
+#pragma once
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+/** @struct cached_object_t
+ *  @brief An immutable response stored in data: header_length bytes of
+ *         status line and header fields, without the blank line that
+ *         ends the header so per-connection fields can follow, then
+ *         body_length bytes of body.
+ */
+typedef struct cached_object {
+    _Atomic int refcount;
+    size_t header_length;
+    size_t body_length;
+    char data[];
+} cached_object_t;
+
+typedef struct object_cache object_cache_t;
+
+/** @brief Dynamically allocates a cache holding at most budget bytes.
+ *
+ *  @return a pointer to a new object_cache_t, or NULL if budget is 0 or
+ *          allocation failed.
+ */
+object_cache_t *object_cache_new(size_t budget);
+
+/** @brief Delete the cache and drop its references to every object.
+ *         Sets *c to NULL.
+ */
+void object_cache_delete(object_cache_t **c);
+
+/** @brief The largest body the cache will accept.  0 for a NULL cache.
+ */
+size_t object_cache_max_object(object_cache_t *c);
+
+/** @brief Looks up uri and takes a reference on the object.
+ *
+ *  @return the object, to be released with cached_object_release, or
+ *          NULL on a miss or a NULL cache.
+ */
+cached_object_t *object_cache_get(object_cache_t *c, const char *uri);
+
+/** @brief Caches obj under uri, replacing any previous object.  The
+ *         cache takes its own reference; the caller keeps theirs.
+ */
+void object_cache_put(object_cache_t *c, const char *uri, cached_object_t *obj);
+
+/** @brief Removes uri from the cache.  Call with the URI's writer lock
+ *         held, after the file has changed.
+ */
+void object_cache_invalidate(object_cache_t *c, const char *uri);
+
+/** @brief Allocates an object with a reference count of 1, copying in
+ *         header.  The caller fills in the body at
+ *         data + header_length.
+ */
+cached_object_t *cached_object_new(const char *header, size_t header_length, size_t body_length);
+
+/** @brief Drops a reference, freeing the object with the last one.
+ */
+void cached_object_release(cached_object_t *obj);
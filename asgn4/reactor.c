@@ -0,0 +1,212 @@
+#define _GNU_SOURCE
+#include "reactor.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include "arena.h"
+
+#define MAX_EVENTS        256
+#define SWEEP_INTERVAL_MS 1000
+#define CONNS_PER_SLAB    64
+
+struct reactor {
+    int epfd;
+    Listener_Socket *listener;
+    dispatch_fn dispatch;
+    void *arg;
+    int idle_timeout;
+    conn_t *conns;
+    _Atomic(conn_t *) reclaim;
+    // Only touched on the reactor thread, which allocates and frees every conn_t
+    fixed_pool_t conn_pool;
+};
+
+reactor_t *reactor_new(
+    Listener_Socket *listener, dispatch_fn dispatch, void *arg, int idle_timeout) {
+    reactor_t *r = (reactor_t *) malloc(sizeof(reactor_t));
+    if (r == NULL) {
+        return NULL;
+    }
+    r->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (r->epfd == -1) {
+        free(r);
+        return NULL;
+    }
+    r->listener = listener;
+    r->dispatch = dispatch;
+    r->arg = arg;
+    r->idle_timeout = idle_timeout;
+    r->conns = NULL;
+    atomic_init(&r->reclaim, NULL);
+    fixed_pool_init(&r->conn_pool, sizeof(conn_t), CONNS_PER_SLAB);
+
+    int flags = fcntl(listener->fd, F_GETFL);
+    fcntl(listener->fd, F_SETFL, flags | O_NONBLOCK);
+
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLET, .data.ptr = NULL };
+    if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, listener->fd, &ev) == -1) {
+        close(r->epfd);
+        free(r);
+        return NULL;
+    }
+    return r;
+}
+
+static void conn_free(reactor_t *r, conn_t *conn) {
+    if (conn->prev != NULL)
+        conn->prev->next = conn->next;
+    else
+        r->conns = conn->next;
+    if (conn->next != NULL)
+        conn->next->prev = conn->prev;
+    fixed_pool_put(&r->conn_pool, conn);
+}
+
+static void conn_arm(reactor_t *r, conn_t *conn, int op) {
+    struct epoll_event ev
+        = { .events = EPOLLIN | EPOLLRDHUP | EPOLLET | EPOLLONESHOT, .data.ptr = conn };
+    epoll_ctl(r->epfd, op, conn->fd, &ev);
+}
+
+static void accept_all(reactor_t *r) {
+    while (1) {
+        int fd = listener_accept(r->listener);
+        if (fd == -1) {
+            // EAGAIN means the backlog is drained; anything else (EMFILE,
+            // ECONNABORTED, ...) is retried on the next readiness edge.
+            return;
+        }
+        conn_t *conn = (conn_t *) fixed_pool_get(&r->conn_pool);
+        if (conn == NULL) {
+            close(fd);
+            continue;
+        }
+        // The reactor itself never blocks on the socket; these bound the
+        // workers' blocking body reads and response writes
+        struct timeval timeout = { .tv_sec = SOCKET_TIMEOUT, .tv_usec = 0 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        conn->fd = fd;
+        conn->len = 0;
+        conn->buf[0] = '\0';
+        atomic_init(&conn->state, CONN_READING);
+        conn->last_active = time(NULL);
+        conn->requests = 0;
+        conn->keep_alive = false;
+        conn->worker = -1;
+        conn->prev = NULL;
+        conn->next = r->conns;
+        if (r->conns != NULL)
+            r->conns->prev = conn;
+        r->conns = conn;
+        conn_arm(r, conn, EPOLL_CTL_ADD);
+    }
+}
+
+static void hand_off(reactor_t *r, conn_t *conn) {
+    atomic_store(&conn->state, CONN_BUSY);
+    r->dispatch(conn, r->arg);
+}
+
+static void read_header(reactor_t *r, conn_t *conn) {
+    while (1) {
+        size_t old_len = conn->len;
+        ssize_t n
+            = recv(conn->fd, conn->buf + conn->len, CONN_BUFFER_SIZE - conn->len, MSG_DONTWAIT);
+        if (n > 0) {
+            conn->len += n;
+            conn->buf[conn->len] = '\0';
+            size_t from = old_len > 3 ? old_len - 3 : 0;
+            if (memmem(conn->buf + from, conn->len - from, "\r\n\r\n", 4) != NULL
+                || conn->len == CONN_BUFFER_SIZE) {
+                hand_off(r, conn);
+                return;
+            }
+            continue;
+        }
+        if (n == 0) {
+            // The client half-closed; let a worker answer whatever it sent.
+            if (conn->len > 0)
+                hand_off(r, conn);
+            else {
+                close(conn->fd);
+                conn_free(r, conn);
+            }
+            return;
+        }
+        if (errno == EINTR)
+            continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            conn_arm(r, conn, EPOLL_CTL_MOD);
+            return;
+        }
+        close(conn->fd);
+        conn_free(r, conn);
+        return;
+    }
+}
+
+static void reclaim_closed(reactor_t *r) {
+    conn_t *conn = atomic_exchange(&r->reclaim, NULL);
+    while (conn != NULL) {
+        conn_t *next = conn->reclaim_next;
+        conn_free(r, conn);
+        conn = next;
+    }
+}
+
+static void sweep_idle(reactor_t *r, time_t now) {
+    conn_t *conn = r->conns;
+    while (conn != NULL) {
+        conn_t *next = conn->next;
+        int timeout = conn->requests > 0 ? r->idle_timeout : HEADER_TIMEOUT;
+        if (atomic_load(&conn->state) == CONN_READING && now - conn->last_active >= timeout) {
+            close(conn->fd);
+            conn_free(r, conn);
+        }
+        conn = next;
+    }
+}
+
+void reactor_run(reactor_t *r) {
+    struct epoll_event events[MAX_EVENTS];
+    time_t last_sweep = time(NULL);
+
+    while (1) {
+        int n = epoll_wait(r->epfd, events, MAX_EVENTS, SWEEP_INTERVAL_MS);
+        // Connections closed by workers are only freed here, on the thread
+        // that owns the connection list.
+        reclaim_closed(r);
+        for (int i = 0; i < n; i++) {
+            conn_t *conn = (conn_t *) events[i].data.ptr;
+            if (conn == NULL)
+                accept_all(r);
+            else
+                read_header(r, conn);
+        }
+        time_t now = time(NULL);
+        if (now != last_sweep) {
+            sweep_idle(r, now);
+            last_sweep = now;
+        }
+    }
+}
+
+void reactor_rearm(reactor_t *r, conn_t *conn) {
+    conn->last_active = time(NULL);
+    atomic_store(&conn->state, CONN_READING);
+    conn_arm(r, conn, EPOLL_CTL_MOD);
+}
+
+void reactor_close(reactor_t *r, conn_t *conn) {
+    close(conn->fd);
+    conn_t *head = atomic_load(&r->reclaim);
+    do {
+        conn->reclaim_next = head;
+    } while (!atomic_compare_exchange_weak(&r->reclaim, &head, conn));
+}
@@ -0,0 +1,92 @@
+/**
+ * @File reactor.h
+ *
+ * Edge-triggered epoll event loop that owns every client connection
+ * while it is idle or still sending its request header.  A connection
+ * is only handed to a worker once its header has fully arrived.
+ */
+
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "asgn2_helper_funcs.h"
+
+#define CONN_BUFFER_SIZE 2048
+
+// Seconds a blocking receive or send on an accepted socket may stall
+// before it fails, so a worker waiting on a body that stopped arriving or
+// on a client that stopped reading gives the connection up
+#define SOCKET_TIMEOUT 5
+
+// Seconds a connection may take to deliver its request header.  This
+// mirrors SOCKET_TIMEOUT, which the reactor sets on every accepted socket.
+#define HEADER_TIMEOUT SOCKET_TIMEOUT
+
+typedef enum { CONN_READING, CONN_BUSY } CONN_STATE;
+
+/** @struct conn_t
+ *  @brief A client connection.  While its state is CONN_READING the
+ *         reactor owns it; once it is CONN_BUSY the worker it was
+ *         dispatched to owns it until it calls reactor_rearm or
+ *         reactor_close.
+ */
+typedef struct conn {
+    int fd;
+    char buf[CONN_BUFFER_SIZE + 1];
+    size_t len;
+    _Atomic int state;
+    time_t last_active;
+    int requests;
+    bool keep_alive;
+    // How much of buf the request being served takes up; anything after it
+    // is the start of the next, pipelined request
+    size_t consumed;
+    // Set while the worker holds TCP_CORK across a batch of pipelined
+    // responses, which single responses must then leave alone
+    bool corked;
+    // The worker that last served this connection, or -1; free for the
+    // dispatcher to use
+    int worker;
+    // When the dispatcher handed the connection over, in stats_now_ns time
+    uint64_t dispatched_ns;
+    struct conn *prev;
+    struct conn *next;
+    struct conn *reclaim_next;
+} conn_t;
+
+typedef struct reactor reactor_t;
+
+/** @brief Called on the reactor thread for every connection whose
+ *         request header is complete (or that can never complete).
+ */
+typedef void (*dispatch_fn)(conn_t *conn, void *arg);
+
+/** @brief Creates a reactor accepting connections from listener.  The
+ *         listener is switched to non-blocking mode.
+ *
+ *  @param idle_timeout Seconds a kept-alive connection may sit idle
+ *         between requests before the reactor closes it.
+ *
+ *  @return a pointer to a new reactor_t, or NULL on failure.
+ */
+reactor_t *reactor_new(
+    Listener_Socket *listener, dispatch_fn dispatch, void *arg, int idle_timeout);
+
+/** @brief Runs the event loop on the calling thread.  Never returns.
+ */
+void reactor_run(reactor_t *r);
+
+/** @brief Hands a connection the caller owns back to the reactor to
+ *         wait for its next request.  The first len bytes of buf are kept
+ *         as the start of that request.  Safe to call from any thread.
+ */
+void reactor_rearm(reactor_t *r, conn_t *conn);
+
+/** @brief Closes a connection the caller owns and hands its memory
+ *         back to the reactor.  Safe to call from any thread.
+ */
+void reactor_close(reactor_t *r, conn_t *conn);
@@ -0,0 +1,247 @@
+#include "stats.h"
+#include <stdalign.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "arena.h"
+
+#define METHOD_COUNT  3 // GET, PUT and everything else
+#define FIRST_STATUS  100
+#define STATUS_COUNT  500
+// Latencies go into log-linear buckets: 8 sub-buckets per power of two,
+// which keeps every percentile within 12.5% of the true value
+#define SUB_BITS      3
+#define BUCKET_COUNT  (64 << SUB_BITS)
+
+static const char *method_names[METHOD_COUNT] = { "GET", "PUT", "other" };
+static const char *latency_names[LATENCY_KINDS] = { "queue_wait_us", "lock_wait_us", "service_us" };
+
+typedef struct histogram {
+    _Atomic uint64_t count;
+    _Atomic uint64_t sum;
+    _Atomic uint64_t max;
+    _Atomic uint64_t buckets[BUCKET_COUNT];
+} histogram_t;
+
+// Written only by the thread that owns it, and read by whoever renders
+typedef struct stats_block {
+    alignas(64) _Atomic int in_use;
+    struct stats_block *next;
+    alignas(64) _Atomic uint64_t requests[METHOD_COUNT][STATUS_COUNT];
+    _Atomic uint64_t bytes_in;
+    _Atomic uint64_t bytes_out;
+    _Atomic uint64_t heap_allocations;
+    histogram_t latency[LATENCY_KINDS];
+} stats_block_t;
+
+static _Atomic(stats_block_t *) blocks = NULL;
+static _Atomic int pool_size = 0;
+static __thread stats_block_t *my_block = NULL;
+
+static stats_block_t *claim_block(void) {
+    for (stats_block_t *block = atomic_load(&blocks); block != NULL; block = block->next) {
+        int expected = 0;
+        if (atomic_compare_exchange_strong(&block->in_use, &expected, 1))
+            return block;
+    }
+    stats_block_t *block = (stats_block_t *) aligned_alloc(64, sizeof(stats_block_t));
+    if (block == NULL)
+        return NULL;
+    memset(block, 0, sizeof(stats_block_t));
+    atomic_init(&block->in_use, 1);
+    block->next = atomic_load(&blocks);
+    while (!atomic_compare_exchange_weak(&blocks, &block->next, block))
+        ;
+    return block;
+}
+
+static stats_block_t *get_block(void) {
+    if (my_block == NULL)
+        my_block = claim_block();
+    return my_block;
+}
+
+// Only the owning thread writes a counter, so a load and a store suffice
+static inline void add(_Atomic uint64_t *counter, uint64_t n) {
+    atomic_store_explicit(
+        counter, atomic_load_explicit(counter, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+static int bucket_of(uint64_t ns) {
+    if (ns < (1u << SUB_BITS))
+        return (int) ns;
+    int top = 63 - __builtin_clzll(ns);
+    int sub = (int) ((ns >> (top - SUB_BITS)) & ((1u << SUB_BITS) - 1));
+    return ((top - SUB_BITS + 1) << SUB_BITS) + sub;
+}
+
+static uint64_t bucket_floor(int bucket) {
+    if (bucket < (1 << SUB_BITS))
+        return bucket;
+    int top = (bucket >> SUB_BITS) + SUB_BITS - 1;
+    uint64_t sub = bucket & ((1 << SUB_BITS) - 1);
+    return (1ULL << top) | (sub << (top - SUB_BITS));
+}
+
+uint64_t stats_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void stats_request(const char *method, int status_code) {
+    stats_block_t *block = get_block();
+    if (block == NULL || status_code < FIRST_STATUS || status_code >= FIRST_STATUS + STATUS_COUNT)
+        return;
+    int m = strcmp(method, "GET") == 0 ? 0 : strcmp(method, "PUT") == 0 ? 1 : 2;
+    add(&block->requests[m][status_code - FIRST_STATUS], 1);
+}
+
+void stats_bytes(size_t in, size_t out) {
+    stats_block_t *block = get_block();
+    if (block == NULL)
+        return;
+    if (in > 0)
+        add(&block->bytes_in, in);
+    if (out > 0)
+        add(&block->bytes_out, out);
+}
+
+void stats_latency(LATENCY_KIND kind, uint64_t ns) {
+    stats_block_t *block = get_block();
+    if (block == NULL)
+        return;
+    histogram_t *h = &block->latency[kind];
+    add(&h->count, 1);
+    add(&h->sum, ns);
+    add(&h->buckets[bucket_of(ns)], 1);
+    if (ns > atomic_load_explicit(&h->max, memory_order_relaxed))
+        atomic_store_explicit(&h->max, ns, memory_order_relaxed);
+}
+
+void stats_heap_allocation(void) {
+    stats_block_t *block = get_block();
+    if (block != NULL)
+        add(&block->heap_allocations, 1);
+}
+
+void stats_pool_size(int workers) {
+    atomic_store_explicit(&pool_size, workers, memory_order_relaxed);
+}
+
+void stats_thread_exit(void) {
+    if (my_block != NULL) {
+        atomic_store(&my_block->in_use, 0);
+        my_block = NULL;
+    }
+}
+
+typedef struct totals {
+    uint64_t requests[METHOD_COUNT][STATUS_COUNT];
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t heap_allocations;
+    uint64_t count[LATENCY_KINDS];
+    uint64_t sum[LATENCY_KINDS];
+    uint64_t max[LATENCY_KINDS];
+    uint64_t buckets[LATENCY_KINDS][BUCKET_COUNT];
+} totals_t;
+
+static void sum_blocks(totals_t *t, int *threads) {
+    memset(t, 0, sizeof(totals_t));
+    *threads = 0;
+    for (stats_block_t *block = atomic_load(&blocks); block != NULL; block = block->next) {
+        *threads += atomic_load_explicit(&block->in_use, memory_order_relaxed);
+        for (int m = 0; m < METHOD_COUNT; m++)
+            for (int s = 0; s < STATUS_COUNT; s++)
+                t->requests[m][s]
+                    += atomic_load_explicit(&block->requests[m][s], memory_order_relaxed);
+        t->bytes_in += atomic_load_explicit(&block->bytes_in, memory_order_relaxed);
+        t->bytes_out += atomic_load_explicit(&block->bytes_out, memory_order_relaxed);
+        t->heap_allocations
+            += atomic_load_explicit(&block->heap_allocations, memory_order_relaxed);
+        for (int k = 0; k < LATENCY_KINDS; k++) {
+            histogram_t *h = &block->latency[k];
+            t->count[k] += atomic_load_explicit(&h->count, memory_order_relaxed);
+            t->sum[k] += atomic_load_explicit(&h->sum, memory_order_relaxed);
+            uint64_t max = atomic_load_explicit(&h->max, memory_order_relaxed);
+            if (max > t->max[k])
+                t->max[k] = max;
+            for (int b = 0; b < BUCKET_COUNT; b++)
+                t->buckets[k][b] += atomic_load_explicit(&h->buckets[b], memory_order_relaxed);
+        }
+    }
+}
+
+// The counters are read while they are being updated, so the histogram may
+// hold a few more or fewer entries than count; ranks are taken from its own sum
+static double percentile_us(const uint64_t *buckets, double p) {
+    uint64_t total = 0;
+    for (int b = 0; b < BUCKET_COUNT; b++)
+        total += buckets[b];
+    uint64_t rank = (uint64_t) (total * p);
+    uint64_t seen = 0;
+    for (int b = 0; b < BUCKET_COUNT; b++) {
+        seen += buckets[b];
+        if (seen > rank)
+            return bucket_floor(b) / 1000.0;
+    }
+    return 0;
+}
+
+typedef struct output {
+    char *buf;
+    size_t size;
+    size_t used;
+} output_t;
+
+static void append(output_t *out, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    size_t room = out->used < out->size ? out->size - out->used : 0;
+    int n = vsnprintf(out->buf + (room > 0 ? out->used : 0), room, format, args);
+    va_end(args);
+    if (n > 0)
+        out->used += n;
+}
+
+size_t stats_render(char *buf, size_t size) {
+    totals_t *t = (totals_t *) arena_alloc(sizeof(totals_t));
+    if (t == NULL)
+        return size;
+    int threads;
+    sum_blocks(t, &threads);
+
+    output_t out = { buf, size, 0 };
+    append(&out, "{\"workers\":%d,\"threads\":%d,\"requests\":{",
+        atomic_load_explicit(&pool_size, memory_order_relaxed), threads);
+    for (int m = 0; m < METHOD_COUNT; m++) {
+        append(&out, "%s\"%s\":{", m > 0 ? "," : "", method_names[m]);
+        const char *separator = "";
+        for (int s = 0; s < STATUS_COUNT; s++) {
+            if (t->requests[m][s] == 0)
+                continue;
+            append(&out, "%s\"%d\":%lu", separator, s + FIRST_STATUS,
+                (unsigned long) t->requests[m][s]);
+            separator = ",";
+        }
+        append(&out, "}");
+    }
+    append(&out, "},\"bytes_in\":%lu,\"bytes_out\":%lu", (unsigned long) t->bytes_in,
+        (unsigned long) t->bytes_out);
+    for (int k = 0; k < LATENCY_KINDS; k++) {
+        uint64_t count = t->count[k];
+        append(&out,
+            ",\"%s\":{\"count\":%lu,\"mean\":%.1f,\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,"
+            "\"p999\":%.1f,\"max\":%.1f}",
+            latency_names[k], (unsigned long) count,
+            count > 0 ? t->sum[k] / 1000.0 / count : 0.0, percentile_us(t->buckets[k], 0.50),
+            percentile_us(t->buckets[k], 0.90), percentile_us(t->buckets[k], 0.99),
+            percentile_us(t->buckets[k], 0.999), t->max[k] / 1000.0);
+    }
+    append(&out, ",\"heap_allocations\":%lu}\n", (unsigned long) t->heap_allocations);
+    return out.used;
+}
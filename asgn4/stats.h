@@ -0,0 +1,56 @@
+/**
+ * @File stats.h
+ *
+ * Per-thread request counters and latency histograms.  Each thread
+ * updates a cache-line aligned block of its own with plain loads and
+ * stores, never a lock or an atomic read-modify-write; the blocks are
+ * only summed up when the statistics are rendered for GET /_stats.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+    LATENCY_QUEUE_WAIT, // From dispatch by the reactor until a worker picks it up
+    LATENCY_LOCK_WAIT, // Waiting for the URI's reader or writer lock
+    LATENCY_SERVICE, // From pickup until the response has been sent
+    LATENCY_KINDS,
+} LATENCY_KIND;
+
+/** @brief The monotonic clock in nanoseconds, for timing with stats_latency.
+ */
+uint64_t stats_now_ns(void);
+
+/** @brief Counts a response with status_code to a request with method.
+ */
+void stats_request(const char *method, int status_code);
+
+/** @brief Adds to the bytes received from and sent to clients.
+ */
+void stats_bytes(size_t in, size_t out);
+
+/** @brief Records one latency of the given kind.
+ */
+void stats_latency(LATENCY_KIND kind, uint64_t ns);
+
+/** @brief Counts one heap allocation made while serving requests.
+ */
+void stats_heap_allocation(void);
+
+/** @brief Records the number of worker threads currently running.
+ */
+void stats_pool_size(int workers);
+
+/** @brief Gives the calling thread's block back for reuse by a later
+ *         thread.  Its counts stay in the totals.
+ */
+void stats_thread_exit(void);
+
+/** @brief Sums up every thread's block and writes it to buf as a JSON
+ *         object.  Uses the calling thread's arena for scratch space.
+ *
+ *  @return The length of the JSON, or a number >= size if it did not fit.
+ */
+size_t stats_render(char *buf, size_t size);
@@ -0,0 +1,81 @@
+#!/bin/bash
+# Checks that a 304 carries the same ETag and Vary as the 200 it
+# revalidates, for a compressible file, an incompressible one, and a range,
+# and that one variant's ETag does not revalidate the other.
+#
+# Usage: test/etag.sh
+#
+#   SERVER_ARGS extra httpserver options, e.g. "-s" or "-r -u"
+#   PORT        port to use (default: random)
+
+set -e
+cd "$(dirname "$0")/.."
+SERVER=$PWD/httpserver
+[ -x "$SERVER" ] || { echo "run make first" >&2; exit 1; }
+
+DIR=$(mktemp -d)
+trap 'kill "$server" 2>/dev/null; rm -rf "$DIR"' EXIT
+
+head -c 100000 /dev/zero | tr '\0' a > "$DIR/text.txt"
+head -c 100000 /dev/urandom > "$DIR/random.bin"
+
+port=${PORT:-$((20000 + RANDOM % 20000))}
+(cd "$DIR" && exec "$SERVER" $SERVER_ARGS "$port" 2>/dev/null) &
+server=$!
+for _ in $(seq 50); do
+    (exec 3<>/dev/tcp/127.0.0.1/"$port") 2>/dev/null && break
+    sleep 0.1
+done
+
+failures=0
+
+# Prints the status of a GET, then its ETag and Vary fields sorted
+fields() {
+    local response
+    response=$(curl -s -o /dev/null -D - "$@" | tr -d '\r')
+    echo "$response" | awk 'NR == 1 { print $2 }'
+    echo "$response" | awk 'tolower($1) ~ /^(etag|vary):$/ { print tolower($1), $2 }' | sort
+}
+
+# check NAME URI ENCODING [RANGE]: GETs URI accepting ENCODING, then
+# revalidates it with the ETag it got, and expects a 304 with the same
+# ETag and Vary.  With a RANGE the revalidation asks for that range, which
+# is cut from the plain body, so it is checked against a plain GET.
+check() {
+    local name=$1 url=http://127.0.0.1:$port$2 encoding=$3 range=$4
+    local full etag revalidated
+    if [ -n "$range" ]; then
+        full=$(fields "$url")
+    else
+        full=$(fields -H "Accept-Encoding: $encoding" "$url")
+    fi
+    etag=$(echo "$full" | awk '$1 == "etag:" { print $2 }')
+    revalidated=$(fields -H "Accept-Encoding: $encoding" ${range:+-H "Range: $range"} \
+        -H "If-None-Match: $etag" "$url")
+    if [ "$(echo "$full" | head -1)" != 200 ] || [ "$(echo "$revalidated" | head -1)" != 304 ] \
+        || [ "$(echo "$full" | tail -n +2)" != "$(echo "$revalidated" | tail -n +2)" ]; then
+        echo "FAIL $name: $(echo $full) then $(echo $revalidated)"
+        failures=$((failures + 1))
+    else
+        echo "ok   $name: $(echo $revalidated)"
+    fi
+}
+
+check "compressible, gzip" /text.txt gzip
+check "compressible, plain" /text.txt identity
+check "incompressible, gzip" /random.bin gzip
+check "incompressible, plain" /random.bin identity
+check "range, gzip" /text.txt gzip bytes=0-99
+
+# The gzip variant's ETag must not revalidate the plain body
+gzip_etag=$(fields -H "Accept-Encoding: gzip" "http://127.0.0.1:$port/text.txt" \
+    | awk '$1 == "etag:" { print $2 }')
+status=$(fields -H "If-None-Match: $gzip_etag" "http://127.0.0.1:$port/text.txt" | head -1)
+if [ "$status" != 200 ]; then
+    echo "FAIL gzip ETag, plain: $status"
+    failures=$((failures + 1))
+else
+    echo "ok   gzip ETag, plain: $status"
+fi
+
+[ "$failures" = 0 ]
@@ -0,0 +1,246 @@
+#include "uri_table.h"
+#include <pthread.h>
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+#define SHARD_COUNT      64
+#define INITIAL_BUCKETS  16
+// Unreferenced entries are kept around, up to this many per shard, so a
+// URI that is requested again soon reuses its lock instead of rebuilding it
+#define IDLE_PER_SHARD   64
+// Entries for URIs up to this long come from the shard's pool, and keep
+// their lock when they are recycled; longer ones are allocated one by one
+#define POOLED_URI_LENGTH 64
+#define ENTRIES_PER_SLAB  32
+
+typedef struct shard {
+    alignas(64) pthread_mutex_t mutex;
+    uri_entry_t **buckets;
+    size_t bucket_count;
+    size_t entry_count;
+    // Least recently released at the head, most recently at the tail
+    uri_entry_t *idle_head;
+    uri_entry_t *idle_tail;
+    size_t idle_count;
+    fixed_pool_t pool;
+} shard_t;
+
+struct uri_table {
+    shard_t shards[SHARD_COUNT];
+};
+
+uint64_t uri_hash(const char *uri) {
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ULL;
+    for (; *uri != '\0'; uri++) {
+        hash ^= (unsigned char) *uri;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static shard_t *shard_for(uri_table_t *t, uint64_t hash) {
+    return &t->shards[hash & (SHARD_COUNT - 1)];
+}
+
+static size_t bucket_for(shard_t *shard, uint64_t hash) {
+    // The low bits already chose the shard
+    return (hash >> 6) & (shard->bucket_count - 1);
+}
+
+uri_table_t *uri_table_new(void) {
+    uri_table_t *t = (uri_table_t *) aligned_alloc(64, sizeof(uri_table_t));
+    if (t == NULL) {
+        return NULL;
+    }
+    for (int i = 0; i < SHARD_COUNT; i++) {
+        shard_t *shard = &t->shards[i];
+        pthread_mutex_init(&shard->mutex, NULL);
+        shard->buckets = (uri_entry_t **) calloc(INITIAL_BUCKETS, sizeof(uri_entry_t *));
+        if (shard->buckets == NULL) {
+            for (int j = 0; j < i; j++)
+                free(t->shards[j].buckets);
+            free(t);
+            return NULL;
+        }
+        shard->bucket_count = INITIAL_BUCKETS;
+        shard->entry_count = 0;
+        shard->idle_head = shard->idle_tail = NULL;
+        shard->idle_count = 0;
+        fixed_pool_init(
+            &shard->pool, sizeof(uri_entry_t) + POOLED_URI_LENGTH + 1, ENTRIES_PER_SLAB);
+    }
+    return t;
+}
+
+static bool is_pooled(size_t length) {
+    return length <= POOLED_URI_LENGTH;
+}
+
+static void entry_free(uri_entry_t *entry) {
+    rwlock_delete(&entry->rwlock);
+    free(entry);
+}
+
+void uri_table_delete(uri_table_t **t) {
+    if (t == NULL || *t == NULL) {
+        return;
+    }
+    for (int i = 0; i < SHARD_COUNT; i++) {
+        shard_t *shard = &(*t)->shards[i];
+        for (size_t b = 0; b < shard->bucket_count; b++) {
+            uri_entry_t *entry = shard->buckets[b];
+            while (entry != NULL) {
+                uri_entry_t *next = entry->next;
+                if (is_pooled(strlen(entry->uri)))
+                    fixed_pool_put(&shard->pool, entry);
+                else
+                    entry_free(entry);
+                entry = next;
+            }
+        }
+        // Recycled entries still own their locks
+        for (void *object = shard->pool.free_list; object != NULL; object = *(void **) object) {
+            uri_entry_t *entry = (uri_entry_t *) object;
+            if (entry->rwlock != NULL)
+                rwlock_delete(&entry->rwlock);
+        }
+        fixed_pool_destroy(&shard->pool);
+        free(shard->buckets);
+        pthread_mutex_destroy(&shard->mutex);
+    }
+    free(*t);
+    *t = NULL;
+}
+
+static void grow(shard_t *shard) {
+    size_t old_count = shard->bucket_count;
+    uri_entry_t **old = shard->buckets;
+    uri_entry_t **buckets = (uri_entry_t **) arena_heap_calloc(old_count * 2, sizeof(uri_entry_t *));
+    if (buckets == NULL) {
+        // Longer chains, but still correct
+        return;
+    }
+    shard->buckets = buckets;
+    shard->bucket_count = old_count * 2;
+    for (size_t b = 0; b < old_count; b++) {
+        uri_entry_t *entry = old[b];
+        while (entry != NULL) {
+            uri_entry_t *next = entry->next;
+            size_t i = bucket_for(shard, entry->hash);
+            entry->next = buckets[i];
+            buckets[i] = entry;
+            entry = next;
+        }
+    }
+    free(old);
+}
+
+static void idle_unlink(shard_t *shard, uri_entry_t *entry) {
+    if (entry->idle_prev != NULL)
+        entry->idle_prev->idle_next = entry->idle_next;
+    else
+        shard->idle_head = entry->idle_next;
+    if (entry->idle_next != NULL)
+        entry->idle_next->idle_prev = entry->idle_prev;
+    else
+        shard->idle_tail = entry->idle_prev;
+    entry->idle_prev = entry->idle_next = NULL;
+    shard->idle_count--;
+}
+
+static void remove_entry(shard_t *shard, uri_entry_t *entry) {
+    uri_entry_t **link = &shard->buckets[bucket_for(shard, entry->hash)];
+    while (*link != entry)
+        link = &(*link)->next;
+    *link = entry->next;
+    shard->entry_count--;
+}
+
+uri_entry_t *uri_table_acquire(uri_table_t *t, const char *uri) {
+    uint64_t hash = uri_hash(uri);
+    shard_t *shard = shard_for(t, hash);
+
+    pthread_mutex_lock(&shard->mutex);
+    uri_entry_t *entry = shard->buckets[bucket_for(shard, hash)];
+    for (; entry != NULL; entry = entry->next) {
+        if (entry->hash == hash && strcmp(entry->uri, uri) == 0) {
+            if (entry->refcount++ == 0)
+                idle_unlink(shard, entry);
+            pthread_mutex_unlock(&shard->mutex);
+            return entry;
+        }
+    }
+
+    size_t length = strlen(uri);
+    if (is_pooled(length)) {
+        entry = (uri_entry_t *) fixed_pool_get(&shard->pool);
+    } else {
+        entry = (uri_entry_t *) arena_heap_alloc(sizeof(uri_entry_t) + length + 1);
+        if (entry != NULL)
+            entry->rwlock = NULL;
+    }
+    if (entry == NULL) {
+        pthread_mutex_unlock(&shard->mutex);
+        return NULL;
+    }
+    // A recycled entry's lock is free, as nobody held a reference to it
+    if (entry->rwlock == NULL)
+        entry->rwlock = rwlock_new(N_WAY, 1);
+    if (entry->rwlock == NULL) {
+        if (is_pooled(length))
+            fixed_pool_put(&shard->pool, entry);
+        else
+            free(entry);
+        pthread_mutex_unlock(&shard->mutex);
+        return NULL;
+    }
+    entry->hash = hash;
+    entry->refcount = 1;
+    entry->idle_prev = entry->idle_next = NULL;
+    memcpy(entry->uri, uri, length + 1);
+
+    if (shard->entry_count >= shard->bucket_count * 2)
+        grow(shard);
+    size_t i = bucket_for(shard, hash);
+    entry->next = shard->buckets[i];
+    shard->buckets[i] = entry;
+    shard->entry_count++;
+    pthread_mutex_unlock(&shard->mutex);
+    return entry;
+}
+
+void uri_table_release(uri_table_t *t, uri_entry_t *entry) {
+    shard_t *shard = shard_for(t, entry->hash);
+    uri_entry_t *victim = NULL;
+
+    pthread_mutex_lock(&shard->mutex);
+    if (--entry->refcount == 0) {
+        entry->idle_prev = shard->idle_tail;
+        entry->idle_next = NULL;
+        if (shard->idle_tail != NULL)
+            shard->idle_tail->idle_next = entry;
+        else
+            shard->idle_head = entry;
+        shard->idle_tail = entry;
+        shard->idle_count++;
+
+        if (shard->idle_count > IDLE_PER_SHARD) {
+            victim = shard->idle_head;
+            idle_unlink(shard, victim);
+            remove_entry(shard, victim);
+            if (is_pooled(strlen(victim->uri))) {
+                fixed_pool_put(&shard->pool, victim);
+                victim = NULL;
+            }
+        }
+    }
+    pthread_mutex_unlock(&shard->mutex);
+
+    // Nobody can reach the victim any more, so tear it down unlocked
+    if (victim != NULL)
+        entry_free(victim);
+}
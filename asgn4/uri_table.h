@@ -0,0 +1,56 @@
+/**
+ * @File uri_table.h
+ *
+ * Registry of the per-URI reader/writer locks.  The table is split into
+ * independently locked shards so lookups of different URIs rarely touch
+ * the same mutex, and entries are reference counted so that the lock of
+ * a URI nobody is using can be reclaimed.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "rwlock.h"
+
+/** @struct uri_entry_t
+ *  @brief The lock for one URI.  The pointer stays valid, and rwlock
+ *         stays the same lock, until the matching uri_table_release.
+ */
+typedef struct uri_entry {
+    uint64_t hash;
+    int refcount;
+    rwlock_t *rwlock;
+    struct uri_entry *next;
+    struct uri_entry *idle_prev;
+    struct uri_entry *idle_next;
+    char uri[];
+} uri_entry_t;
+
+typedef struct uri_table uri_table_t;
+
+/** @brief The hash the table uses for uri, for other per-URI structures.
+ */
+uint64_t uri_hash(const char *uri);
+
+/** @brief Dynamically allocates and initializes an empty table.
+ *
+ *  @return a pointer to a new uri_table_t, or NULL on failure.
+ */
+uri_table_t *uri_table_new(void);
+
+/** @brief Delete the table and every entry in it.  No entry may still
+ *         be acquired.  Sets *t to NULL.
+ */
+void uri_table_delete(uri_table_t **t);
+
+/** @brief Looks up the entry for uri, creating it if needed, and takes
+ *         a reference on it.
+ *
+ *  @return the entry, or NULL if it could not be allocated.
+ */
+uri_entry_t *uri_table_acquire(uri_table_t *t, const char *uri);
+
+/** @brief Drops a reference taken by uri_table_acquire.  The caller
+ *         must no longer hold or wait on entry->rwlock.
+ */
+void uri_table_release(uri_table_t *t, uri_entry_t *entry);
@@ -0,0 +1,520 @@
+#include "uring_io.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// The ring is driven with raw system calls rather than liburing, which is
+// not available everywhere this server is built.  Each worker submits a
+// batch, waits for all of it, and then looks at the results, so apart from
+// queued closes nothing is in flight between calls.
+
+#define RING_ENTRIES 32
+#define CHUNK_SIZE   (64 << 10)
+// Chunk buffers per ring: one half is sent or filled while the other half
+// is being read or written
+#define CHUNKS       8
+#define HALF         (CHUNKS / 2)
+// user_data of operations whose completion nobody waits for
+#define UNWAITED     UINT64_MAX
+
+struct uring_io {
+    int ring_fd;
+    unsigned sq_entries;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_map;
+    size_t sq_map_size;
+    void *cq_map;
+    size_t cq_map_size;
+    size_t sqes_size;
+    // Prepared but not yet accepted by the kernel
+    unsigned queued;
+    // Results of completed operations, indexed by tag, and how many of them
+    // have not been waited for yet
+    int results[CHUNKS + HALF + 2];
+    unsigned reaped;
+    // Set if a wait failed with operations possibly still in flight; the
+    // ring and its buffers are then left alone for good
+    bool broken;
+    char *chunks;
+};
+
+static bool enabled = false;
+static __thread uring_io_t *thread_ring = NULL;
+static __thread bool thread_ring_failed = false;
+
+static int sys_setup(unsigned entries, struct io_uring_params *params) {
+    return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int) syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_register(int ring_fd, unsigned opcode, void *arg, unsigned count) {
+    return (int) syscall(__NR_io_uring_register, ring_fd, opcode, arg, count);
+}
+
+bool uring_io_init(void) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int ring_fd = sys_setup(2, &params);
+    if (ring_fd < 0) {
+        return false;
+    }
+    static const int needed[]
+        = { IORING_OP_OPENAT, IORING_OP_CLOSE, IORING_OP_READ, IORING_OP_WRITE, IORING_OP_SEND,
+              IORING_OP_LINK_TIMEOUT };
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = (struct io_uring_probe *) calloc(1, size);
+    bool supported = probe != NULL && sys_register(ring_fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+    for (size_t i = 0; supported && i < sizeof(needed) / sizeof(needed[0]); i++) {
+        supported = needed[i] < probe->ops_len
+                    && (probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED);
+    }
+    free(probe);
+    close(ring_fd);
+    enabled = supported;
+    return enabled;
+}
+
+static void ring_free(uring_io_t *io) {
+    if (io->sqes != MAP_FAILED)
+        munmap(io->sqes, io->sqes_size);
+    if (io->cq_map != MAP_FAILED && io->cq_map != io->sq_map)
+        munmap(io->cq_map, io->cq_map_size);
+    if (io->sq_map != MAP_FAILED)
+        munmap(io->sq_map, io->sq_map_size);
+    close(io->ring_fd);
+    free(io->chunks);
+    free(io);
+}
+
+static uring_io_t *ring_new(void) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int ring_fd = sys_setup(RING_ENTRIES, &params);
+    if (ring_fd < 0) {
+        return NULL;
+    }
+    uring_io_t *io = (uring_io_t *) calloc(1, sizeof(uring_io_t));
+    if (io == NULL) {
+        close(ring_fd);
+        return NULL;
+    }
+    io->ring_fd = ring_fd;
+    io->sq_map = io->cq_map = io->sqes = MAP_FAILED;
+    io->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    io->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    io->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    bool single_map = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_map && io->cq_map_size > io->sq_map_size)
+        io->sq_map_size = io->cq_map_size;
+
+    io->sq_map = mmap(NULL, io->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        ring_fd, IORING_OFF_SQ_RING);
+    io->cq_map = single_map ? io->sq_map
+                            : mmap(NULL, io->cq_map_size, PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+    io->sqes = mmap(NULL, io->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        ring_fd, IORING_OFF_SQES);
+    io->chunks = (char *) malloc((size_t) CHUNKS * CHUNK_SIZE);
+    if (io->sq_map == MAP_FAILED || io->cq_map == MAP_FAILED || io->sqes == MAP_FAILED
+        || io->chunks == NULL) {
+        ring_free(io);
+        return NULL;
+    }
+
+    char *sq = (char *) io->sq_map;
+    char *cq = (char *) io->cq_map;
+    io->sq_entries = params.sq_entries;
+    io->sq_head = (unsigned *) (sq + params.sq_off.head);
+    io->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+    io->sq_mask = *(unsigned *) (sq + params.sq_off.ring_mask);
+    io->sq_array = (unsigned *) (sq + params.sq_off.array);
+    io->cq_head = (unsigned *) (cq + params.cq_off.head);
+    io->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+    io->cq_mask = *(unsigned *) (cq + params.cq_off.ring_mask);
+    io->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+    return io;
+}
+
+uring_io_t *uring_io_get(void) {
+    if (!enabled || thread_ring_failed) {
+        return NULL;
+    }
+    if (thread_ring == NULL && (thread_ring = ring_new()) == NULL) {
+        thread_ring_failed = true;
+        return NULL;
+    }
+    return thread_ring->broken ? NULL : thread_ring;
+}
+
+void uring_io_thread_exit(void) {
+    if (thread_ring != NULL && !thread_ring->broken) {
+        // Collect any queued close before the ring goes away
+        sys_enter(thread_ring->ring_fd, thread_ring->queued, 0, 0);
+        ring_free(thread_ring);
+    }
+    thread_ring = NULL;
+}
+
+// Queues one operation; op_flags goes into the per-opcode flags union
+// (open flags, msg flags or rw flags)
+static void prep(uring_io_t *io, int opcode, int fd, const void *addr, unsigned len, uint64_t off,
+    uint64_t tag, unsigned sqe_flags, unsigned op_flags) {
+    unsigned tail = *io->sq_tail;
+    if (tail - __atomic_load_n(io->sq_head, __ATOMIC_ACQUIRE) >= io->sq_entries) {
+        // Never happens for the batch sizes used here, but keep the ring sane
+        int submitted = sys_enter(io->ring_fd, io->queued, 0, 0);
+        if (submitted > 0)
+            io->queued -= submitted;
+    }
+    unsigned index = tail & io->sq_mask;
+    struct io_uring_sqe *sqe = &io->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->flags = sqe_flags;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) addr;
+    sqe->len = len;
+    sqe->off = off;
+    sqe->rw_flags = op_flags;
+    sqe->user_data = tag;
+    io->sq_array[index] = index;
+    __atomic_store_n(io->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    io->queued++;
+}
+
+// Submits everything queued and waits for count completions.  The result
+// of the operation tagged i lands in io->results[i].
+static int complete(uring_io_t *io, unsigned count) {
+    while (1) {
+        unsigned head = *io->cq_head;
+        unsigned tail = __atomic_load_n(io->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            struct io_uring_cqe *cqe = &io->cqes[head & io->cq_mask];
+            if (cqe->user_data != UNWAITED) {
+                io->results[cqe->user_data] = cqe->res;
+                io->reaped++;
+            }
+        }
+        __atomic_store_n(io->cq_head, head, __ATOMIC_RELEASE);
+        if (io->reaped >= count && io->queued == 0) {
+            io->reaped -= count;
+            return 0;
+        }
+
+        int submitted = sys_enter(
+            io->ring_fd, io->queued, io->reaped < count ? 1 : 0, IORING_ENTER_GETEVENTS);
+        if (submitted < 0) {
+            if (errno == EINTR)
+                continue;
+            io->broken = true;
+            return -1;
+        }
+        io->queued -= submitted;
+    }
+}
+
+// The socket has a receive and send timeout, so the kernel does not restart
+// a blocking call that the ring's task work interrupts; these retry it.
+// recv_n_bytes only comes back short at end of stream.
+static ssize_t recv_n_bytes(int fd, char *buf, size_t count) {
+    size_t done = 0;
+    while (done < count) {
+        ssize_t bytes = read(fd, buf + done, count - done);
+        if (bytes < 0 && errno == EINTR)
+            continue;
+        if (bytes < 0)
+            return -1;
+        if (bytes == 0)
+            break;
+        done += bytes;
+    }
+    return done;
+}
+
+static ssize_t send_n_bytes(int fd, const char *buf, size_t count) {
+    size_t done = 0;
+    while (done < count) {
+        ssize_t bytes = write(fd, buf + done, count - done);
+        if (bytes < 0 && errno == EINTR)
+            continue;
+        if (bytes <= 0)
+            return -1;
+        done += bytes;
+    }
+    return done;
+}
+
+static char *chunk(uring_io_t *io, int half, unsigned i) {
+    return io->chunks + ((size_t) half * HALF + i) * CHUNK_SIZE;
+}
+
+int uring_io_open(uring_io_t *io, const char *path, int flags, mode_t mode) {
+    prep(io, IORING_OP_OPENAT, AT_FDCWD, path, mode, 0, 0, 0, flags);
+    if (complete(io, 1) < 0)
+        return -1;
+    int result = io->results[0];
+    if (result < 0) {
+        errno = -result;
+        return -1;
+    }
+    return result;
+}
+
+int uring_io_close(uring_io_t *io, int fd, bool wait) {
+    prep(io, IORING_OP_CLOSE, fd, NULL, 0, 0, wait ? 0 : UNWAITED, 0, 0);
+    if (complete(io, wait ? 1 : 0) < 0)
+        return -1;
+    int result = wait ? io->results[0] : 0;
+    if (result < 0) {
+        errno = -result;
+        return -1;
+    }
+    return 0;
+}
+
+// Finishes a read that came back short, as regular files only do at EOF
+static bool finish_read(int fd, char *buf, size_t length, int result, off_t offset) {
+    if (result < 0)
+        return false;
+    for (size_t done = result; done < length;) {
+        ssize_t bytes = pread(fd, buf + done, length - done, offset + done);
+        if (bytes <= 0)
+            return false;
+        done += bytes;
+    }
+    return true;
+}
+
+ssize_t uring_io_read(uring_io_t *io, int fd, char *buf, size_t count, off_t offset) {
+    size_t done = 0;
+    while (done < count) {
+        unsigned chunks = 0;
+        size_t lengths[CHUNKS];
+        for (size_t queued = done; chunks < CHUNKS && queued < count; chunks++) {
+            lengths[chunks] = count - queued < CHUNK_SIZE ? count - queued : CHUNK_SIZE;
+            prep(io, IORING_OP_READ, fd, buf + queued, lengths[chunks], offset + queued, chunks,
+                0, 0);
+            queued += lengths[chunks];
+        }
+        if (complete(io, chunks) < 0)
+            return -1;
+        for (unsigned i = 0; i < chunks; i++) {
+            if (!finish_read(fd, buf + done, lengths[i], io->results[i], offset + done))
+                return -1;
+            done += lengths[i];
+        }
+    }
+    return count;
+}
+
+// Queues reads of up to HALF chunks of the body into one half of the
+// buffers, tagged first_tag onwards.  Returns the number of chunks.
+static unsigned queue_reads(uring_io_t *io, int half, int fd, off_t offset, size_t remaining,
+    size_t *lengths, unsigned first_tag) {
+    unsigned chunks = 0;
+    for (; chunks < HALF && remaining > 0; chunks++) {
+        lengths[chunks] = remaining < CHUNK_SIZE ? remaining : CHUNK_SIZE;
+        prep(io, IORING_OP_READ, fd, chunk(io, half, chunks), lengths[chunks], offset,
+            first_tag + chunks, 0, 0);
+        offset += lengths[chunks];
+        remaining -= lengths[chunks];
+    }
+    return chunks;
+}
+
+// The ring waits for a blocked send without regard to the socket's
+// SO_SNDTIMEO, so that timeout is applied to each send as a linked timeout
+static bool send_timeout(int client_fd, struct __kernel_timespec *timeout) {
+    struct timeval tv;
+    socklen_t length = sizeof(tv);
+    if (getsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &tv, &length) != 0
+        || (tv.tv_sec == 0 && tv.tv_usec == 0))
+        return false;
+    timeout->tv_sec = tv.tv_sec;
+    timeout->tv_nsec = tv.tv_usec * 1000;
+    return true;
+}
+
+ssize_t uring_io_send_file(uring_io_t *io, int client_fd, const char *header,
+    size_t header_length, int file_fd, off_t offset, size_t count) {
+    // Tags: the sends (header first) from 0, the reads after them, then the
+    // timeouts of the sends
+    enum { SEND_TAG = 0, READ_TAG = HALF + 1, TIMEOUT_TAG = READ_TAG + HALF };
+    struct __kernel_timespec timeout;
+    bool timed = send_timeout(client_fd, &timeout);
+    size_t ready[HALF], next[HALF];
+    size_t read_position = 0;
+    int half = 0;
+
+    unsigned ready_count = queue_reads(io, half, file_fd, offset, count, ready, READ_TAG);
+    if (complete(io, ready_count) < 0)
+        return -1;
+    for (unsigned i = 0; i < ready_count; i++) {
+        if (!finish_read(file_fd, chunk(io, half, i), ready[i], io->results[READ_TAG + i],
+                offset + read_position))
+            return -1;
+        read_position += ready[i];
+    }
+
+    bool header_pending = header_length > 0;
+    while (ready_count > 0 || header_pending) {
+        // The sends are linked so they reach the socket in order; MSG_MORE
+        // lets the kernel pack the header with the start of the body
+        const char *data[HALF + 1];
+        size_t lengths[HALF + 1];
+        unsigned sends = 0;
+        if (header_pending) {
+            data[sends] = header;
+            lengths[sends++] = header_length;
+        }
+        for (unsigned i = 0; i < ready_count; i++) {
+            data[sends] = chunk(io, half, i);
+            lengths[sends++] = ready[i];
+        }
+        for (unsigned i = 0; i < sends; i++) {
+            bool last = i + 1 == sends;
+            bool more = !last || read_position < count;
+            prep(io, IORING_OP_SEND, client_fd, data[i], lengths[i], 0, SEND_TAG + i,
+                last && !timed ? 0 : IOSQE_IO_LINK, MSG_WAITALL | (more ? MSG_MORE : 0));
+            if (timed)
+                prep(io, IORING_OP_LINK_TIMEOUT, -1, &timeout, 1, 0, TIMEOUT_TAG + i,
+                    last ? 0 : IOSQE_IO_LINK, 0);
+        }
+        // Meanwhile read the next chunks into the other half
+        unsigned next_count = queue_reads(
+            io, !half, file_fd, offset + read_position, count - read_position, next, READ_TAG);
+        if (complete(io, (timed ? 2 : 1) * sends + next_count) < 0)
+            return -1;
+        for (unsigned i = 0; timed && i < sends; i++) {
+            if (io->results[TIMEOUT_TAG + i] == -ETIME)
+                return -1;
+        }
+
+        // A send that came back short breaks the link, so the sends after it
+        // are cancelled; finish them in order with plain writes
+        for (unsigned i = 0; i < sends; i++) {
+            int result = io->results[SEND_TAG + i];
+            if (result == (int) lengths[i])
+                continue;
+            if (result < 0 && result != -ECANCELED && result != -EINTR)
+                return -1;
+            size_t sent = result > 0 ? (size_t) result : 0;
+            if (send_n_bytes(client_fd, data[i] + sent, lengths[i] - sent) < 0)
+                return -1;
+        }
+        for (unsigned i = 0; i < next_count; i++) {
+            if (!finish_read(file_fd, chunk(io, !half, i), next[i], io->results[READ_TAG + i],
+                    offset + read_position))
+                return -1;
+            read_position += next[i];
+            ready[i] = next[i];
+        }
+        ready_count = next_count;
+        header_pending = false;
+        half = !half;
+    }
+    return count;
+}
+
+// Checks the writes of one half and finishes any that came back short
+static bool finish_writes(
+    int file_fd, char *const *data, const size_t *lengths, const off_t *offsets,
+    const int *results, unsigned count) {
+    for (unsigned i = 0; i < count; i++) {
+        if (results[i] < 0)
+            return false;
+        for (size_t done = results[i]; done < lengths[i];) {
+            ssize_t bytes = pwrite(file_fd, data[i] + done, lengths[i] - done, offsets[i] + done);
+            if (bytes <= 0)
+                return false;
+            done += bytes;
+        }
+    }
+    return true;
+}
+
+ssize_t uring_io_recv_file(uring_io_t *io, int client_fd, int file_fd, off_t offset, size_t count) {
+    char *data[2][HALF];
+    size_t lengths[2][HALF];
+    off_t offsets[2][HALF];
+    unsigned in_flight[2] = { 0, 0 };
+    size_t received = 0;
+    bool failed = false;
+    bool done = count == 0;
+    int half = 0;
+
+    while (!done) {
+        // Fill this half from the socket while the other half is written
+        unsigned filled = 0;
+        while (filled < HALF && received < count) {
+            size_t want = count - received < CHUNK_SIZE ? count - received : CHUNK_SIZE;
+            ssize_t bytes = recv_n_bytes(client_fd, chunk(io, half, filled), want);
+            if (bytes < 0)
+                failed = true;
+            if (bytes <= 0) {
+                done = true;
+                break;
+            }
+            data[half][filled] = chunk(io, half, filled);
+            lengths[half][filled] = bytes;
+            offsets[half][filled] = offset + received;
+            filled++;
+            received += bytes;
+            // recv_n_bytes only comes back short at end of stream
+            if ((size_t) bytes < want) {
+                done = true;
+                break;
+            }
+        }
+        if (received == count)
+            done = true;
+
+        int other = !half;
+        if (in_flight[other] > 0) {
+            if (complete(io, in_flight[other]) < 0)
+                return -1;
+            if (!finish_writes(file_fd, data[other], lengths[other], offsets[other],
+                    io->results + other * HALF, in_flight[other]))
+                failed = true;
+            in_flight[other] = 0;
+        }
+        for (unsigned i = 0; i < filled && !failed; i++) {
+            prep(io, IORING_OP_WRITE, file_fd, data[half][i], lengths[half][i], offsets[half][i],
+                half * HALF + i, 0, 0);
+            in_flight[half]++;
+        }
+        if (complete(io, 0) < 0)
+            return -1;
+        half = other;
+    }
+    // Wait for the last writes before the buffers can be reused
+    for (int h = 0; h < 2; h++) {
+        if (in_flight[h] > 0) {
+            if (complete(io, in_flight[h]) < 0)
+                return -1;
+            if (!finish_writes(file_fd, data[h], lengths[h], offsets[h], io->results + h * HALF,
+                    in_flight[h]))
+                failed = true;
+        }
+    }
+    return failed ? -1 : (ssize_t) received;
+}
@@ -0,0 +1,72 @@
+/**
+ * @File uring_io.h
+ *
+ * Optional io_uring backend for the file I/O done by worker threads.
+ * Every worker gets its own ring and keeps several file reads or writes
+ * in flight at once, instead of blocking in one read(2) or write(2) at a
+ * time.  Callers fall back to plain system calls whenever uring_io_get
+ * returns NULL.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+typedef struct uring_io uring_io_t;
+
+/** @brief Enables the backend if the kernel supports io_uring and every
+ *         operation it uses.  Called once at startup, before any worker
+ *         calls uring_io_get.
+ *
+ *  @return true if the backend is enabled.
+ */
+bool uring_io_init(void);
+
+/** @brief Returns the calling thread's ring, creating it on first use.
+ *
+ *  @return The ring, or NULL if the backend is disabled or the ring
+ *          could not be set up.
+ */
+uring_io_t *uring_io_get(void);
+
+/** @brief Tears down the calling thread's ring, if it has one. */
+void uring_io_thread_exit(void);
+
+/** @brief open(2) through the ring.  Returns the fd, or -1 with errno set.
+ */
+int uring_io_open(uring_io_t *io, const char *path, int flags, mode_t mode);
+
+/** @brief close(2) through the ring.  Unless wait is set the close is only
+ *         queued, and its result is collected by a later call.
+ *
+ *  @return 0, or -1 with errno set if a waited-for close failed.
+ */
+int uring_io_close(uring_io_t *io, int fd, bool wait);
+
+/** @brief Reads exactly count bytes of fd from offset into buf, with
+ *         several chunk reads in flight.
+ *
+ *  @return count, or -1 if the file could not be read that far.
+ */
+ssize_t uring_io_read(uring_io_t *io, int fd, char *buf, size_t count, off_t offset);
+
+/** @brief Sends header followed by count bytes of file_fd from offset to
+ *         client_fd.  File reads for the next chunks are in flight while
+ *         the current ones are sent; sends are linked so they stay in order.
+ *         Each send fails if it stalls for longer than client_fd's
+ *         SO_SNDTIMEO, as a blocking send would.
+ *
+ *  @return The number of bytes sent, or -1 on error.
+ */
+ssize_t uring_io_send_file(uring_io_t *io, int client_fd, const char *header,
+    size_t header_length, int file_fd, off_t offset, size_t count);
+
+/** @brief Receives count bytes from client_fd and writes them to file_fd
+ *         starting at offset, with the writes of earlier chunks in flight
+ *         while later ones are received.
+ *
+ *  @return The number of bytes stored (short if the client closed early),
+ *          or -1 on error.
+ */
+ssize_t uring_io_recv_file(uring_io_t *io, int client_fd, int file_fd, off_t offset, size_t count);
@@ -0,0 +1,215 @@
+#include "work_pool.h"
+#include <linux/futex.h>
+#include <sched.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define SPIN_LIMIT 64
+
+typedef struct worker_slot {
+    // The deque: the reactor pushes at bottom, workers take from top
+    alignas(64) _Atomic size_t top;
+    alignas(64) _Atomic size_t bottom;
+    _Atomic(void *) *items;
+    // Bumped to wake the worker while sleeping is set
+    alignas(64) _Atomic uint32_t wake_seq;
+    _Atomic int sleeping;
+    // Only written by the worker itself
+    alignas(64) _Atomic uint64_t local_hits;
+    _Atomic uint64_t steal_attempts;
+    _Atomic uint64_t steal_successes;
+} worker_slot_t;
+
+struct work_pool {
+    int workers;
+    size_t mask;
+    worker_slot_t *slots;
+};
+
+static void cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+static void futex_wait(_Atomic uint32_t *addr, uint32_t expected) {
+    syscall(SYS_futex, (uint32_t *) addr, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+static void futex_wake(_Atomic uint32_t *addr, int count) {
+    syscall(SYS_futex, (uint32_t *) addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+work_pool_t *work_pool_new(int workers, int depth) {
+    if (workers <= 0 || depth <= 0) {
+        return NULL;
+    }
+    size_t capacity = 1;
+    while (capacity < (size_t) depth)
+        capacity <<= 1;
+
+    work_pool_t *p = (work_pool_t *) malloc(sizeof(work_pool_t));
+    if (p == NULL) {
+        return NULL;
+    }
+    p->slots = (worker_slot_t *) aligned_alloc(64, workers * sizeof(worker_slot_t));
+    if (p->slots == NULL) {
+        free(p);
+        return NULL;
+    }
+    p->workers = workers;
+    p->mask = capacity - 1;
+    for (int i = 0; i < workers; i++) {
+        worker_slot_t *slot = &p->slots[i];
+        slot->items = (_Atomic(void *) *) calloc(capacity, sizeof(*slot->items));
+        if (slot->items == NULL) {
+            p->workers = i;
+            work_pool_delete(&p);
+            return NULL;
+        }
+        atomic_init(&slot->top, 0);
+        atomic_init(&slot->bottom, 0);
+        atomic_init(&slot->wake_seq, 0);
+        atomic_init(&slot->sleeping, 0);
+        atomic_init(&slot->local_hits, 0);
+        atomic_init(&slot->steal_attempts, 0);
+        atomic_init(&slot->steal_successes, 0);
+    }
+    return p;
+}
+
+void work_pool_delete(work_pool_t **p) {
+    if (p == NULL || *p == NULL) {
+        return;
+    }
+    for (int i = 0; i < (*p)->workers; i++)
+        free((*p)->slots[i].items);
+    free((*p)->slots);
+    free(*p);
+    *p = NULL;
+}
+
+static bool try_push(work_pool_t *p, worker_slot_t *slot, void *item) {
+    size_t bottom = atomic_load_explicit(&slot->bottom, memory_order_relaxed);
+    size_t top = atomic_load_explicit(&slot->top, memory_order_acquire);
+    if (bottom - top > p->mask)
+        return false;
+    atomic_store_explicit(&slot->items[bottom & p->mask], item, memory_order_relaxed);
+    atomic_store_explicit(&slot->bottom, bottom + 1, memory_order_release);
+    return true;
+}
+
+// Takes the item at the top of slot's deque.  Returns NULL if the deque is
+// empty; *lost is set if it was not, but another worker got there first.
+static void *try_take(work_pool_t *p, worker_slot_t *slot, bool *lost) {
+    size_t top = atomic_load_explicit(&slot->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    size_t bottom = atomic_load_explicit(&slot->bottom, memory_order_acquire);
+    *lost = false;
+    if (top >= bottom)
+        return NULL;
+    void *item = atomic_load_explicit(&slot->items[top & p->mask], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(
+            &slot->top, &top, top + 1, memory_order_seq_cst, memory_order_relaxed)) {
+        *lost = true;
+        return NULL;
+    }
+    return item;
+}
+
+static void wake(worker_slot_t *slot) {
+    atomic_fetch_add(&slot->wake_seq, 1);
+    futex_wake(&slot->wake_seq, 1);
+}
+
+void work_pool_push(work_pool_t *p, int worker, void *item) {
+    int target = worker;
+    while (!try_push(p, &p->slots[target], item)) {
+        target = (target + 1) % p->workers;
+        if (target == worker)
+            sched_yield();
+    }
+    // Pairs with the fence in work_pool_pop: either the sleeper finds the
+    // item, or we see it sleeping.  If the owner is busy, wake someone else
+    // to steal the item.
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&p->slots[target].sleeping, memory_order_relaxed)) {
+        wake(&p->slots[target]);
+        return;
+    }
+    for (int i = 1; i < p->workers; i++) {
+        worker_slot_t *slot = &p->slots[(target + i) % p->workers];
+        if (atomic_load_explicit(&slot->sleeping, memory_order_relaxed)) {
+            wake(slot);
+            return;
+        }
+    }
+}
+
+static void count(_Atomic uint64_t *counter) {
+    atomic_store_explicit(
+        counter, atomic_load_explicit(counter, memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+// One pass over the worker's own deque and then its peers'
+static void *find_work(work_pool_t *p, int worker) {
+    worker_slot_t *self = &p->slots[worker];
+    bool lost;
+    void *item;
+    do {
+        item = try_take(p, self, &lost);
+    } while (lost);
+    if (item != NULL) {
+        count(&self->local_hits);
+        return item;
+    }
+    for (int i = 1; i < p->workers; i++) {
+        worker_slot_t *victim = &p->slots[(worker + i) % p->workers];
+        if (atomic_load_explicit(&victim->top, memory_order_relaxed)
+            == atomic_load_explicit(&victim->bottom, memory_order_relaxed))
+            continue;
+        count(&self->steal_attempts);
+        item = try_take(p, victim, &lost);
+        if (item != NULL) {
+            count(&self->steal_successes);
+            return item;
+        }
+    }
+    return NULL;
+}
+
+void *work_pool_pop(work_pool_t *p, int worker) {
+    worker_slot_t *self = &p->slots[worker];
+    while (1) {
+        for (int spin = 0; spin < SPIN_LIMIT; spin++) {
+            void *item = find_work(p, worker);
+            if (item != NULL)
+                return item;
+            cpu_relax();
+        }
+        uint32_t seen = atomic_load(&self->wake_seq);
+        atomic_store(&self->sleeping, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        void *item = find_work(p, worker);
+        if (item == NULL)
+            futex_wait(&self->wake_seq, seen);
+        atomic_store(&self->sleeping, 0);
+        if (item != NULL)
+            return item;
+    }
+}
+
+void work_pool_stats(work_pool_t *p, work_stats_t *stats) {
+    stats->local_hits = stats->steal_attempts = stats->steal_successes = 0;
+    for (int i = 0; i < p->workers; i++) {
+        stats->local_hits += atomic_load_explicit(&p->slots[i].local_hits, memory_order_relaxed);
+        stats->steal_attempts
+            += atomic_load_explicit(&p->slots[i].steal_attempts, memory_order_relaxed);
+        stats->steal_successes
+            += atomic_load_explicit(&p->slots[i].steal_successes, memory_order_relaxed);
+    }
+}
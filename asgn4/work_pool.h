@@ -0,0 +1,52 @@
+/**
+ * @File work_pool.h
+ *
+ * Per-worker deques for handing connections from the reactor to the
+ * workers.  Each worker takes work from its own deque first and steals
+ * from its peers' deques when it runs dry.  The reactor is the only
+ * thread that pushes, at the bottom; the owner and the thieves alike take
+ * from the top with a CAS, so every deque is FIFO for its owner too.
+ * Unlike a Chase-Lev deque the owner has no pop at the bottom, since the
+ * reactor rather than the owner pushes there.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+typedef struct work_pool work_pool_t;
+
+/** @struct work_stats_t
+ *  @brief Counters summed over all workers.  A steal attempt is a visit
+ *         to a peer's deque that looked non-empty.
+ */
+typedef struct {
+    uint64_t local_hits;
+    uint64_t steal_attempts;
+    uint64_t steal_successes;
+} work_stats_t;
+
+/** @brief Creates a deque of depth items for each of the workers.
+ *
+ *  @return a pointer to a new work_pool_t, or NULL on failure.
+ */
+work_pool_t *work_pool_new(int workers, int depth);
+
+/** @brief Frees the pool and sets *p to NULL.
+ */
+void work_pool_delete(work_pool_t **p);
+
+/** @brief Pushes item onto the deque of the given worker, or onto the
+ *         next one with room if that is full, and wakes a worker to take
+ *         it.  Must only be called from one thread.
+ */
+void work_pool_push(work_pool_t *p, int worker, void *item);
+
+/** @brief Takes an item for the given worker, from its own deque if
+ *         possible and from a peer's otherwise.  Blocks until there is one.
+ */
+void *work_pool_pop(work_pool_t *p, int worker);
+
+/** @brief Adds up the counters of every worker.
+ */
+void work_pool_stats(work_pool_t *p, work_stats_t *stats);